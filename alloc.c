@@ -0,0 +1,109 @@
+#define _GNU_SOURCE
+#include "alloc.h"
+#include "defs.h"
+#include "mem.h"
+#include "utils.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef __linux__
+    #include <linux/mempolicy.h>
+    #include <sys/mman.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+    #define UT_HAVE_MMAP 1
+#else
+    #define UT_HAVE_MMAP 0
+#endif
+
+#define HUGE_PAGE_SIZE (2 << 20)
+#define VIDEO_ALLOC_FLAGS (VIDEO_ALLOC_THP | VIDEO_ALLOC_HUGETLB | VIDEO_ALLOC_NODE_LOCAL)
+
+
+#if UT_HAVE_MMAP
+
+static size_t page_round(size_t size, int flags) {
+    size_t page = flags & (VIDEO_ALLOC_THP | VIDEO_ALLOC_HUGETLB)
+        ? HUGE_PAGE_SIZE : (size_t)sysconf(_SC_PAGESIZE);
+    return (size + page - 1) & ~(page - 1);
+}
+
+// Over-map and trim, so THP can back the whole range with 2 MB pages
+static void * map_aligned(size_t size, size_t align) {
+    uint8_t * p, * start;
+    size_t head;
+
+    p = mmap(NULL, size + align, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+
+    start = (uint8_t *)(((uintptr_t)p + align - 1) & ~(uintptr_t)(align - 1));
+    head  = start - p;
+    if (head)
+        munmap(p, head);
+    munmap(start + size, align - head);
+    return start;
+}
+
+static void * policy_alloc(void * opaque, size_t size) {
+    const int flags = (int)(intptr_t)opaque;
+    void * p = MAP_FAILED;
+
+    size = page_round(size, flags);
+
+    if (flags & VIDEO_ALLOC_HUGETLB) {
+        p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    }
+    if (p == MAP_FAILED) {
+        p = map_aligned(size, flags & (VIDEO_ALLOC_THP | VIDEO_ALLOC_HUGETLB)
+            ? HUGE_PAGE_SIZE : (size_t)sysconf(_SC_PAGESIZE));
+        if (!p)
+            return NULL;
+        if (flags & (VIDEO_ALLOC_THP | VIDEO_ALLOC_HUGETLB))
+            madvise(p, size, MADV_HUGEPAGE);
+    }
+
+    // Overrides a process wide policy such as interleaving, nothing is
+    // faulted in yet, so the pages follow the decoding thread
+    if (flags & VIDEO_ALLOC_NODE_LOCAL)
+        syscall(__NR_mbind, p, size, MPOL_LOCAL, NULL, 0, 0);
+
+    return p;
+}
+
+static void policy_free(void * opaque, void * ptr, size_t size) {
+    if (ptr)
+        munmap(ptr, page_round(size, (int)(intptr_t)opaque));
+}
+
+#define POLICY(flags) { policy_alloc, policy_free, (void *)(intptr_t)(flags) }
+
+static const VideoAllocator policies[VIDEO_ALLOC_FLAGS + 1] = {
+    POLICY(0), POLICY(1), POLICY(2), POLICY(3),
+    POLICY(4), POLICY(5), POLICY(6), POLICY(7),
+};
+
+#endif
+
+
+const VideoAllocator * video_allocator_get(int flags) {
+#if UT_HAVE_MMAP
+    flags &= VIDEO_ALLOC_FLAGS;
+    return flags ? &policies[flags] : NULL;
+#else
+    (void)flags;
+    return NULL;
+#endif
+}
+
+void * video_buf_alloc(const VideoAllocator * a, size_t size) {
+    return a ? a->alloc(a->opaque, size) : av_malloc(size);
+}
+
+void video_buf_free(const VideoAllocator * a, void * ptr, size_t size) {
+    if (a)
+        a->free(a->opaque, ptr, size);
+    else
+        free(ptr);
+}
@@ -0,0 +1,40 @@
+#ifndef __UT_ALLOC_H__
+#define __UT_ALLOC_H__
+
+#include <stddef.h>
+
+// Built-in policies, combined as flags
+#define VIDEO_ALLOC_THP        1 // 2 MB aligned, madvise(MADV_HUGEPAGE)
+#define VIDEO_ALLOC_HUGETLB    2 // MAP_HUGETLB from the reserved pool, THP if it's empty
+#define VIDEO_ALLOC_NODE_LOCAL 4 // mbind(MPOL_LOCAL), pages land on the node touching them
+
+
+/**
+ * Where the frame buffers of a context come from: planes, RGBA output and
+ * the row buffer are one allocation, replaced only when the frame size
+ * or format changes. The memory isn't written on allocation, so with a
+ * page-backed policy its first touch is the thread decoding into it.
+ */
+typedef struct VideoAllocator {
+    void * (*alloc)(void * opaque, size_t size);
+    // Gets the size given to alloc
+    void (*free)(void * opaque, void * ptr, size_t size);
+    void * opaque;
+} VideoAllocator;
+
+
+/**
+ * The built-in allocator for a combination of VIDEO_ALLOC_* flags,
+ * NULL (av_malloc) for 0.
+ */
+const VideoAllocator * video_allocator_get(int flags);
+
+/**
+ * @param a NULL for av_malloc
+ */
+void * video_buf_alloc(const VideoAllocator * a, size_t size);
+
+void video_buf_free(const VideoAllocator * a, void * ptr, size_t size);
+
+
+#endif // __UT_ALLOC_H__
@@ -0,0 +1,204 @@
+#include "async.h"
+#include "decoder.h"
+#include "defs.h"
+#include "scheduler.h"
+#include "utils.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#define ASYNC_MAX_DEPTH 256
+
+
+typedef struct AsyncSlot {
+    // First, a completion's frame is its slot
+    VideoContext ctx;
+    VideoAsync * a;
+    uint64_t tag;
+    int status;
+    int busy;                   // from submit to release
+    struct AsyncSlot * next;    // in the completion queue
+} AsyncSlot;
+
+struct VideoAsync {
+    AsyncSlot * slots;
+    int depth;
+    SchedulerStream * stream;
+
+    async_done_fn * done;
+    void * opaque;
+
+    // Completed frames in order, signalled on efd
+    pthread_mutex_t lock;
+    AsyncSlot * head;
+    AsyncSlot ** tail;
+    int efd;
+};
+
+
+static void async_job(void * arg) {
+    AsyncSlot * slot = arg;
+    VideoAsync * a = slot->a;
+    const uint64_t one = 1;
+    int got_frame = 0, ret;
+
+    ret = decode_frame(&slot->ctx, &got_frame);
+    slot->status = ret < 0 ? ret : 0;
+
+    if (a->done) {
+        const AsyncCompletion c = { slot->tag, slot->status, &slot->ctx };
+        a->done(a->opaque, &c);
+        async_release(a, &c);
+        return;
+    }
+
+    pthread_mutex_lock(&a->lock);
+    slot->next = NULL;
+    *a->tail = slot;
+    a->tail = &slot->next;
+    pthread_mutex_unlock(&a->lock);
+    // Only fails when the counter would overflow, it is readable then
+    if (write(a->efd, &one, sizeof(one)) < 0)
+        log_info("eventfd write failed\n");
+}
+
+VideoAsync * async_open(
+    const VideoContext * stream, int depth, async_done_fn * done, void * opaque
+) {
+    Scheduler * sched;
+    VideoAsync * a;
+
+    if (!stream->planes)
+        return NULL;
+    sched = scheduler_global();
+    if (!sched)
+        return NULL;
+    if (depth <= 0)
+        depth = scheduler_threads(sched);
+    depth = MIN(depth, ASYNC_MAX_DEPTH);
+
+    a = calloc(1, sizeof(*a));
+    if (!a)
+        return NULL;
+    a->depth  = depth;
+    a->done   = done;
+    a->opaque = opaque;
+    a->tail   = &a->head;
+    a->efd    = -1;
+    pthread_mutex_init(&a->lock, NULL);
+
+    a->slots  = calloc(depth, sizeof(*a->slots));
+    a->efd    = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    a->stream = scheduler_stream_open(sched, SCHEDULER_WEIGHT_DEFAULT);
+    if (!a->slots || a->efd < 0 || !a->stream)
+        goto fail;
+
+    for (int i = 0; i < depth; i++) {
+        VideoContext * c = &a->slots[i].ctx;
+
+        a->slots[i].a = a;
+        c->w      = stream->w;
+        c->h      = stream->h;
+        c->fps    = stream->fps;
+        c->slices = stream->slices;
+        c->format = stream->format;
+        c->flags  = stream->flags & ~VIDEO_FLAG_CONCEAL;
+        c->preview_shift = stream->preview_shift;
+        c->output_format = stream->output_format;
+        c->output_matrix = stream->output_matrix;
+        memcpy(c->output_scale, stream->output_scale, sizeof(c->output_scale));
+        memcpy(c->output_offset, stream->output_offset, sizeof(c->output_offset));
+        c->allocator = stream->allocator;
+        if (video_init(c) < 0)
+            goto fail;
+    }
+    return a;
+
+fail:
+    async_close(a);
+    return NULL;
+}
+
+int async_submit(VideoAsync * a, const VideoPacket * pkt, uint64_t tag) {
+    AsyncSlot * slot = NULL;
+    int ret;
+
+    pthread_mutex_lock(&a->lock);
+    for (int i = 0; i < a->depth && !slot; i++) {
+        if (!a->slots[i].busy)
+            slot = &a->slots[i];
+    }
+    if (slot)
+        slot->busy = 1;
+    pthread_mutex_unlock(&a->lock);
+    if (!slot)
+        return AVERROR(EAGAIN);
+
+    // The decoder only reads the packet, no need for a copy
+    slot->ctx.packet_data = (uint8_t *)pkt->data;
+    slot->ctx.packet_size = pkt->size;
+    slot->tag = tag;
+
+    // Not a child of the job whose callback may be submitting, the chain
+    // of frames would run nested on one worker's stack
+    ret = scheduler_submit_detached(a->stream, async_job, slot);
+    if (ret < 0) {
+        pthread_mutex_lock(&a->lock);
+        slot->busy = 0;
+        pthread_mutex_unlock(&a->lock);
+    }
+    return ret;
+}
+
+int async_fd(const VideoAsync * a) {
+    return a->efd;
+}
+
+int async_reap(VideoAsync * a, AsyncCompletion * c) {
+    AsyncSlot * slot;
+
+    pthread_mutex_lock(&a->lock);
+    slot = a->head;
+    if (slot) {
+        a->head = slot->next;
+        if (!a->head)
+            a->tail = &a->head;
+    }
+    pthread_mutex_unlock(&a->lock);
+    if (!slot)
+        return 0;
+
+    c->tag    = slot->tag;
+    c->status = slot->status;
+    c->frame  = &slot->ctx;
+    return 1;
+}
+
+void async_release(VideoAsync * a, const AsyncCompletion * c) {
+    AsyncSlot * slot = (AsyncSlot *)c->frame;
+
+    slot->ctx.packet_data = NULL;
+    slot->ctx.packet_size = 0;
+    pthread_mutex_lock(&a->lock);
+    slot->busy = 0;
+    pthread_mutex_unlock(&a->lock);
+}
+
+void async_close(VideoAsync * a) {
+    if (!a)
+        return;
+    scheduler_stream_close(a->stream);
+    for (int i = 0; a->slots && i < a->depth; i++) {
+        // The packets were the caller's
+        a->slots[i].ctx.packet_data = NULL;
+        video_free(&a->slots[i].ctx);
+    }
+    free(a->slots);
+    if (a->efd >= 0)
+        close(a->efd);
+    pthread_mutex_destroy(&a->lock);
+    free(a);
+}
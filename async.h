@@ -0,0 +1,79 @@
+#ifndef __UT_ASYNC_H__
+#define __UT_ASYNC_H__
+
+#include "batch.h"
+#include "video.h"
+#include <stdint.h>
+
+
+/**
+ * Non-blocking decoding for event loops.
+ *
+ * Packets are submitted with a tag and decoded as jobs of the shared
+ * scheduler, up to depth at once, each into its own context. A finished
+ * frame is queued and signalled on an eventfd, or handed to a callback on
+ * the worker that decoded it. Its output stays valid until released, then
+ * the context takes the next packet.
+ *
+ * The contexts are set up like the stream context, without concealment:
+ * frames can finish in any order, there is no previous frame to take the
+ * damaged slices from. A new frame size or format needs a new instance.
+ */
+typedef struct VideoAsync VideoAsync;
+
+typedef struct AsyncCompletion {
+    uint64_t tag;
+    int status;                 // 0 or the decode_frame error
+    const VideoContext * frame;
+} AsyncCompletion;
+
+/**
+ * Called on a scheduler worker, the frame is released on return. It may
+ * submit the next packet, its own context only takes one after it returns.
+ */
+typedef void (async_done_fn)(void * opaque, const AsyncCompletion * c);
+
+
+/**
+ * @param stream context the stream header was parsed into, its geometry
+ *               and output settings are used
+ * @param depth  frames in flight, one per scheduler thread if 0
+ * @param done   optional, replaces the completion queue
+ * @returns NULL on failure
+ */
+VideoAsync * async_open(
+    const VideoContext * stream, int depth, async_done_fn * done, void * opaque
+);
+
+/**
+ * Queue a packet, it is read in place and must stay valid until its frame
+ * completes.
+ * @returns 0, AVERROR(EAGAIN) with depth frames unreleased, or another
+ *          negative AVERROR
+ */
+int async_submit(VideoAsync * a, const VideoPacket * pkt, uint64_t tag);
+
+/**
+ * Readable when frames completed. Read it to clear it before calling
+ * async_reap() until it returns 0, or a completion can be missed.
+ */
+int async_fd(const VideoAsync * a);
+
+/**
+ * Take the next completed frame, without waiting.
+ * @returns 1 with c filled in, 0 if there is none
+ */
+int async_reap(VideoAsync * a, AsyncCompletion * c);
+
+/**
+ * Give the context of a reaped frame back for the next packets.
+ */
+void async_release(VideoAsync * a, const AsyncCompletion * c);
+
+/**
+ * Waits for the frames in flight, the unreleased ones go as well.
+ */
+void async_close(VideoAsync * a);
+
+
+#endif // __UT_ASYNC_H__
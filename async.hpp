@@ -0,0 +1,192 @@
+#ifndef __UT_ASYNC_HPP__
+#define __UT_ASYNC_HPP__
+
+// C++20 coroutine layer over the async API: co_await decoder.decode(packet)
+// suspends until the frame is decoded on the scheduler workers, and the
+// coroutine resumes on the event loop thread calling dispatch().
+
+#include "decoder.hpp"
+
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <unistd.h>
+#include <utility>
+
+extern "C" {
+#include "async.h"
+}
+
+
+namespace ut {
+
+class AsyncDecoder;
+
+/**
+ * A decoded frame, its context goes back to the decoder on destruction.
+ */
+class AsyncFrame {
+public:
+    AsyncFrame() noexcept = default;
+    AsyncFrame(AsyncFrame && other) noexcept { *this = std::move(other); }
+
+    AsyncFrame & operator=(AsyncFrame && other) noexcept {
+        if (this != &other) {
+            reset();
+            d_ = std::exchange(other.d_, nullptr);
+            c_ = other.c_;
+            frame_ = other.frame_;
+        }
+        return *this;
+    }
+
+    AsyncFrame(const AsyncFrame &) = delete;
+    AsyncFrame & operator=(const AsyncFrame &) = delete;
+
+    ~AsyncFrame() { reset(); }
+
+    // 0 or a negative AVERROR, from decoding or from the submission
+    int status() const noexcept { return c_.status; }
+    const Frame & frame() const noexcept { return frame_; }
+
+    inline void reset() noexcept;
+
+private:
+    friend class AsyncDecoder;
+
+    AsyncDecoder * d_ = nullptr;
+    AsyncCompletion c_ = {};
+    Frame frame_;
+};
+
+/**
+ * Owns a VideoAsync. Single threaded like the event loop it runs in: the
+ * awaits, dispatch() and the frames all stay on one thread. Submissions
+ * beyond the depth wait in order for a released frame. The decoder must
+ * outlive the coroutines awaiting it.
+ */
+class AsyncDecoder {
+public:
+    class DecodeAwaiter {
+    public:
+        bool await_ready() const noexcept { return false; }
+
+        // Resumes right away if the packet couldn't be submitted
+        bool await_suspend(std::coroutine_handle<> h) noexcept {
+            handle_ = h;
+            return d_->start(this);
+        }
+
+        AsyncFrame await_resume() noexcept { return std::move(result_); }
+
+    private:
+        friend class AsyncDecoder;
+
+        DecodeAwaiter(AsyncDecoder * d, span<const std::byte> packet) noexcept
+            : d_(d), pkt_{ reinterpret_cast<const uint8_t *>(packet.data()),
+                           static_cast<uint32_t>(packet.size()) } {}
+
+        AsyncDecoder * d_;
+        VideoPacket pkt_;
+        std::coroutine_handle<> handle_;
+        AsyncFrame result_;
+    };
+
+    AsyncDecoder() noexcept = default;
+
+    // The awaiters point back at it
+    AsyncDecoder(const AsyncDecoder &) = delete;
+    AsyncDecoder & operator=(const AsyncDecoder &) = delete;
+
+    ~AsyncDecoder() { async_close(a_); }
+
+    /**
+     * @param stream context holding the stream header, see async_open()
+     */
+    int open(const VideoContext & stream, int depth = 0) noexcept {
+        async_close(a_);
+        a_ = async_open(&stream, depth, nullptr, nullptr);
+        return a_ ? 0 : AVERROR(EINVAL);
+    }
+
+    // To wait on for dispatch()
+    int fd() const noexcept { return async_fd(a_); }
+
+    /**
+     * Decode a packet, which must stay valid and padded like VideoPacket
+     * until the await returns.
+     */
+    DecodeAwaiter decode(span<const std::byte> packet) noexcept { return { this, packet }; }
+
+    /**
+     * Resume the coroutines whose frames are done, call when fd() is
+     * readable.
+     */
+    void dispatch() noexcept {
+        AsyncCompletion c;
+        uint64_t count;
+
+        // Cleared first, a frame completing from here on signals again
+        if (read(async_fd(a_), &count, sizeof(count)) < 0)
+            count = 0;
+        while (async_reap(a_, &c)) {
+            DecodeAwaiter * w = reinterpret_cast<DecodeAwaiter *>(c.tag);
+
+            w->result_.d_ = this;
+            w->result_.c_ = c;
+            w->result_.frame_ = frame_view(*c.frame);
+            w->handle_.resume();
+        }
+    }
+
+private:
+    friend class AsyncFrame;
+
+    // false to resume the awaiting coroutine at once
+    bool start(DecodeAwaiter * w) noexcept {
+        if (!waiting_.empty())
+            return queue(w);
+        const int ret = a_ ? async_submit(a_, &w->pkt_, reinterpret_cast<uintptr_t>(w)) : AVERROR(EINVAL);
+        if (ret == AVERROR(EAGAIN))
+            return queue(w);
+        w->result_.c_.status = ret;
+        return ret == 0;
+    }
+
+    bool queue(DecodeAwaiter * w) noexcept {
+        waiting_.push_back(w);
+        return true;
+    }
+
+    void release(const AsyncCompletion & c) noexcept {
+        async_release(a_, &c);
+
+        // The context that was freed takes the oldest waiting packet
+        while (!waiting_.empty()) {
+            DecodeAwaiter * w = waiting_.front();
+            const int ret = async_submit(a_, &w->pkt_, reinterpret_cast<uintptr_t>(w));
+
+            if (ret == AVERROR(EAGAIN))
+                break;
+            waiting_.pop_front();
+            if (ret < 0) {
+                w->result_.c_.status = ret;
+                w->handle_.resume();
+            }
+        }
+    }
+
+    VideoAsync * a_ = nullptr;
+    std::deque<DecodeAwaiter *> waiting_;
+};
+
+inline void AsyncFrame::reset() noexcept {
+    if (d_)
+        std::exchange(d_, nullptr)->release(c_);
+    frame_ = Frame();
+}
+
+} // namespace ut
+
+
+#endif // __UT_ASYNC_HPP__
@@ -0,0 +1,176 @@
+#include "batch.h"
+#include "decoder.h"
+#include "defs.h"
+#include "mem.h"
+#include "scheduler.h"
+#include "utils.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BATCH_MAX_THREADS 64
+
+
+typedef struct BatchJob {
+    VideoBatch * b;
+    VideoContext * worker;
+    const VideoPacket * pkts;
+    int n;
+    uint8_t * out;
+    int * status;
+    int * next;     // next packet to claim, shared by the workers
+} BatchJob;
+
+
+// Point the output of the worker at its frame in the clip
+static void batch_bind_frame(VideoContext * w, uint8_t * frame) {
+    if (video_is_rgb(w)) {
+        w->result_frame_data = (uint32_t *)frame;
+        return;
+    }
+    for (int i = 0; i < w->planes; i++) {
+        w->frame_data[i] = frame;
+        frame += (size_t)w->linesize[i] * w->plane_h[i];
+    }
+}
+
+static void batch_worker(void * arg) {
+    BatchJob * job = arg;
+    VideoContext * w = job->worker;
+    int idx, got_frame, ret;
+
+    while ((idx = __atomic_fetch_add(job->next, 1, __ATOMIC_RELAXED)) < job->n) {
+        batch_bind_frame(w, job->out + idx * job->b->frame_size);
+
+        // The decoder only reads the packet, no need for a copy
+        w->packet_data = (uint8_t *)job->pkts[idx].data;
+        w->packet_size = job->pkts[idx].size;
+
+        got_frame = 0;
+        ret = decode_frame(w, &got_frame);
+        job->status[idx] = ret < 0 ? ret : 0;
+    }
+
+    w->packet_data = NULL;
+    w->packet_size = 0;
+}
+
+
+int batch_init(VideoBatch * b, const VideoContext * stream, int threads) {
+    size_t planes_size = 0, vlc_size, worker_size;
+    Scheduler * sched;
+    uint8_t * p;
+
+    memset(b, 0, sizeof(*b));
+    if (!stream->planes)
+        return AVERROR(EINVAL);
+
+    // The frames are jobs of the shared scheduler, so many batches running
+    // at once don't start more threads than there are cores
+    sched = scheduler_global();
+    if (!sched)
+        return AVERROR(ENOMEM);
+    if (threads <= 0)
+        threads = scheduler_threads(sched);
+    b->threads = MIN(MAX(threads, 1), BATCH_MAX_THREADS);
+
+    if (video_is_rgb(stream)) {
+        b->frame_size = (size_t)(stream->w + LINE_ALIGNMENT_PAD) * stream->h * 4;
+        for (int i = 0; i < stream->planes; i++)
+            planes_size += (size_t)stream->linesize[i] * stream->plane_h[i];
+    } else {
+        for (int i = 0; i < stream->planes; i++)
+            b->frame_size += (size_t)stream->linesize[i] * stream->plane_h[i];
+    }
+    planes_size = (planes_size + MEM_ALIGN_SIZE - 1) & ~(size_t)(MEM_ALIGN_SIZE - 1);
+    vlc_size    = (stream->w + 8 + MEM_ALIGN_SIZE - 1) & ~(size_t)(MEM_ALIGN_SIZE - 1);
+    worker_size = planes_size + vlc_size;
+
+    b->workers = calloc(b->threads, sizeof(*b->workers));
+    b->scratch_size = worker_size * b->threads;
+    b->scratch = video_buf_alloc(stream->allocator, b->scratch_size);
+    b->allocator = stream->allocator;
+    b->stream  = scheduler_stream_open(sched, SCHEDULER_WEIGHT_DEFAULT);
+    if (!b->workers || !b->scratch || !b->stream) {
+        batch_free(b);
+        return AVERROR(ENOMEM);
+    }
+
+    p = b->scratch;
+    for (int t = 0; t < b->threads; t++) {
+        VideoContext * w = &b->workers[t];
+
+        w->w      = stream->w;
+        w->h      = stream->h;
+        w->slices = stream->slices;
+        w->format = stream->format;
+        w->planes = stream->planes;
+        memcpy(w->plane_w, stream->plane_w, sizeof(w->plane_w));
+        memcpy(w->plane_h, stream->plane_h, sizeof(w->plane_h));
+        memcpy(w->linesize, stream->linesize, sizeof(w->linesize));
+
+        if (video_is_rgb(w)) {
+            uint8_t * plane = p;
+
+            for (int i = 0; i < w->planes; i++) {
+                w->frame_data[i] = plane;
+                plane += (size_t)w->linesize[i] * w->plane_h[i];
+            }
+        }
+        // The planes are first touched by the worker decoding into them
+        w->vlc_buf = p + planes_size;
+        w->vlc_buf_size = stream->w + 8;
+        memset(w->vlc_buf, 0, w->vlc_buf_size);
+        p += worker_size;
+    }
+
+    return 0;
+}
+
+int batch_decode(
+    VideoBatch * b, const VideoPacket * pkts, int n, uint8_t * out, int * status
+) {
+    BatchJob jobs[BATCH_MAX_THREADS];
+    int threads = MIN(b->threads, n), submitted = 0, next = 0, ret = 0;
+    int * st = status;
+
+    if (n <= 0)
+        return 0;
+    if (!st && !(st = malloc(n * sizeof(*st))))
+        return AVERROR(ENOMEM);
+
+    for (int t = 0; t < threads; t++) {
+        jobs[t] = (BatchJob){
+            .b = b, .worker = &b->workers[t],
+            .pkts = pkts, .n = n, .out = out, .status = st, .next = &next,
+        };
+    }
+    // Each job keeps claiming packets, so any that got submitted finish
+    // the batch, the caller does it if none could be
+    for (int t = 0; t < threads; t++) {
+        if (scheduler_submit(b->stream, batch_worker, &jobs[t]) < 0)
+            break;
+        submitted++;
+    }
+    if (!submitted)
+        batch_worker(&jobs[0]);
+    scheduler_stream_wait(b->stream);
+
+    for (int i = 0; i < n && !ret; i++)
+        ret = st[i];
+
+    if (st != status)
+        free(st);
+    return ret;
+}
+
+void batch_free(VideoBatch * b) {
+    // Planes and row buffers live in b->scratch, only the slice buffers
+    // are the workers' own
+    for (int t = 0; b->workers && t < b->threads; t++)
+        free(b->workers[t].slice_buf);
+    scheduler_stream_close(b->stream);
+    free(b->workers);
+    video_buf_free(b->allocator, b->scratch, b->scratch_size);
+    memset(b, 0, sizeof(*b));
+}
@@ -0,0 +1,66 @@
+#ifndef __UT_BATCH_H__
+#define __UT_BATCH_H__
+
+#include "scheduler.h"
+#include "video.h"
+#include <stddef.h>
+#include <stdint.h>
+
+
+typedef struct VideoPacket {
+    // Followed by AV_INPUT_BUFFER_PADDING_SIZE readable bytes,
+    // the slices are read in 32-bit words
+    const uint8_t * data;
+    uint32_t size;
+} VideoPacket;
+
+/**
+ * Decodes clips of packets from one stream on several threads, straight
+ * into a caller provided buffer holding the whole clip.
+ *
+ * Frame i is written at out + i * batch_frame_size(). RGB frames are packed
+ * RGBA rows (NHWC with 4 channels when LINE_ALIGNMENT_PAD is 0), YUV frames
+ * are their planes back to back, each plane rows linesize apart.
+ *
+ * YUV planes are decoded in place in the output. RGB needs G/B/R planes
+ * per worker, those and the row buffers of all workers are one allocation.
+ * The workers run as jobs of one stream of the shared scheduler.
+ */
+typedef struct VideoBatch {
+    VideoContext * workers;
+    int threads;
+    SchedulerStream * stream;
+    size_t frame_size;
+    uint8_t * scratch;
+    size_t scratch_size;
+    // The stream's, scratch is allocated the same way as its frames
+    const VideoAllocator * allocator;
+} VideoBatch;
+
+
+/**
+ * @param stream  context the stream header was parsed into, only its
+ *                geometry is used
+ * @param threads frames decoded at once, one per scheduler thread if 0
+ */
+int batch_init(VideoBatch * b, const VideoContext * stream, int threads);
+
+static av_always_inline size_t batch_frame_size(const VideoBatch * b) {
+    return b->frame_size;
+}
+
+/**
+ * Decode n packets into out, which holds n * batch_frame_size() bytes
+ * and is at least 4-byte aligned.
+ * @param status the result of each packet, may be NULL
+ * @returns 0 if every packet decoded, the first failure otherwise
+ *          (the other frames are still decoded)
+ */
+int batch_decode(
+    VideoBatch * b, const VideoPacket * pkts, int n, uint8_t * out, int * status
+);
+
+void batch_free(VideoBatch * b);
+
+
+#endif // __UT_BATCH_H__
@@ -32,8 +32,13 @@ static av_always_inline void bits_refill_16(BitstreamContext * restrict bc) {
     bc->bits_valid += 16;
 }
 
-static av_pure_expr uint32_t bits_get_left(const BitstreamContext * restrict bc) {
-    return ((uint32_t)(bc->buffer_end - bc->ptr) << 3) + bc->bits_valid;
+/**
+ * Bits left to be read, negative once the reader went past the end.
+ * The refills don't check the end, so the caller needs enough padding
+ * after the buffer to cover whatever it reads between two checks.
+ */
+static av_pure_expr int bits_get_left(const BitstreamContext * restrict bc) {
+    return (int)bc->size_in_bits - (int)((bc->ptr - bc->buffer) << 3) + bc->bits_valid;
 }
 
 static av_pure_expr uint32_t bits_get_32(const BitstreamContext *bc, uint8_t n) {
@@ -63,9 +68,11 @@ static inline int bits_init(
     uint32_t bit_size
 ) {
     if (bit_size > INT_MAX - 7 || !buffer) {
-        bc->buffer     = NULL;
-        bc->ptr        = NULL;
-        bc->bits_valid = 0;
+        bc->buffer       = NULL;
+        bc->buffer_end   = NULL;
+        bc->ptr          = NULL;
+        bc->size_in_bits = 0;
+        bc->bits_valid   = 0;
         return AVERROR_INVALIDDATA;
     }
 
@@ -2,12 +2,15 @@ VERSION = 0.2.1
 BIN_NAME = utminidec.a
 
 INCS = -I.
-LIBS =
+LIBS = -lpthread
 
 # flags
 CPPFLAGS = 
 CFLAGS   = -std=c17 -pedantic -Wall -Wno-deprecated-declarations -Os ${INCS} ${CPPFLAGS}
 LDFLAGS  = ${LIBS}
+# appended for dsp.c
+DSPFLAGS = -O3
 
 CC = gcc
+AR = ar
 
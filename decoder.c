@@ -0,0 +1,700 @@
+#include "decoder.h"
+#include "defs.h"
+#include "video.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <memory.h>
+#include "utils.h"
+#include "bitstream.h"
+#include "bytestream.h"
+#include "vlc.h"
+#include "dsp.h"
+#include "mem.h"
+#include "scheduler.h"
+
+
+typedef struct HuffEntry {
+    uint8_t len;
+    uint16_t sym;
+} HuffEntry;
+
+int build_huff(VideoContext *ctx, const uint8_t *src, VLC *vlc,
+                      VLC_MULTI *multi, int *fsym)
+{
+    int i;
+    uint8_t v;
+    HuffEntry he[1024];
+    uint8_t bits[1024];
+    uint16_t codes_count[33] = { 0 };
+
+    *fsym = -1;
+    for (i = 0; i < UT_HUFF_ELEMS; i++) {
+        v = src[i];
+        
+        switch (v) {
+            case 0:
+                *fsym = i;
+                return 0;
+            case 255:
+                bits[i] = 0;
+                break;
+            case 1: case 2: case 3: case 4: case 5: case 6: case 7: case 8: case 9: case 10: case 11: case 12: case 13: case 14: case 15: case 16: case 17: case 18: case 19: case 20: case 21: case 22: case 23: case 24: case 25: case 26: case 27: case 28: case 29: case 30: case 31: case 32:
+                bits[i] = v;
+                break;
+            default:
+                return AVERROR_INVALIDDATA;
+        }
+
+        codes_count[bits[i]]++;
+    }
+    if (codes_count[0] == UT_HUFF_ELEMS)
+        return AVERROR_INVALIDDATA;
+
+    /* For Ut Video, longer codes are to the left of the tree and
+     * for codes with the same length the symbol is descending from
+     * left to right. So after the next loop --codes_count[i] will
+     * be the index of the first (lowest) symbol of length i when
+     * indexed by the position in the tree with left nodes being first. */
+    for (int i = 31; i >= 0; i--) 
+        codes_count[i] += codes_count[i + 1];
+
+    for (unsigned i = 0; i < UT_HUFF_ELEMS; i++)
+        he[--codes_count[bits[i]]] = (HuffEntry) { bits[i], i };
+
+    // The last arg is the log context, f it for now
+    int a = vlc_init_multi_from_lengths(
+        vlc, multi, codes_count[0],
+        &he[0].len, sizeof(*he),
+        &he[0].sym, sizeof(*he)
+    );
+
+    log_info("A=%d\n", a);
+    return a;
+}
+
+
+/**
+ * Reconstruct one row of a slice from its residuals.
+ * @param row row index inside of the slice
+ * @param A, B the median predictor state carried from row to row
+ */
+static av_always_inline void restore_row(
+    int pred, int row,
+    uint8_t *dest, ptrdiff_t stride,
+    const uint8_t *buf, int width,
+    int *prev, int *A, int *B
+) {
+    switch (pred) {
+    case UT_PRED_NONE:
+        memcpy(dest, buf, width);
+        break;
+    case UT_PRED_LEFT:
+        add_left_pred(dest, buf, width, *prev);
+        *prev = dest[width - 1];
+        break;
+    case UT_PRED_GRADIENT:
+        // the first line of a slice is left predicted
+        if (!row)
+            add_left_pred(dest, buf, width, 0x80);
+        else
+            add_gradient_pred(dest, dest - stride, buf, width);
+        break;
+    case UT_PRED_MEDIAN:
+        // the first line of a slice is left predicted,
+        // the first pixel of the second one has top prediction
+        if (!row) {
+            add_left_pred(dest, buf, width, 0x80);
+        } else if (row == 1) {
+            dest[0] = buf[0] + dest[-stride];
+            *A = dest[0];
+            *B = dest[-stride];
+            add_median_pred(dest + 1, dest + 1 - stride, buf + 1, width - 1, A, B);
+        } else {
+            add_median_pred(dest, dest - stride, buf, width, A, B);
+        }
+        break;
+    }
+}
+
+
+#define PLANE_END_PAD 5
+// A row reads at most 32 bits per pixel, plus the reader's look-ahead
+#define SLICE_ROW_OVERREAD(w) ((w) * 4 + 8)
+// Slice jobs of a frame, more than the scheduler has workers only queue
+#define SLICE_MAX_JOBS 64
+#define JOB_ALIGN(x) (((x) + MEM_ALIGN_SIZE - 1) & ~(size_t)(MEM_ALIGN_SIZE - 1))
+
+// Huffman tables of a plane, built once per frame for all of its slices
+typedef struct PlaneVLC {
+    VLC vlc;
+    VLC_MULTI multi;
+    int fsym;
+    // The slice end offsets, followed by the slice data
+    const uint8_t *src;
+} PlaneVLC;
+
+/**
+ * Rows of a slice in a plane of the given height.
+ */
+static av_always_inline void slice_rows(
+    const VideoContext *ctx, int plane_no, int height, int slice,
+    int *sstart, int *send
+) {
+    video_slice_rows(ctx, plane_no, height, ctx->slices, slice, sstart, send);
+}
+
+/**
+ * @param slice_buf, buf scratch for the byte swapped slice and a row of
+ *                       residuals, sized as ctx->slice_buf and ctx->vlc_buf
+ */
+static int decode_slice(
+    const VideoContext *ctx, int plane_no, const PlaneVLC *p,
+    uint8_t *slice_buf, uint8_t *buf,
+    uint8_t *dst, ptrdiff_t stride,
+    int width, int height, int slice
+) {
+    int i, j;
+    int sstart, send;
+    GetBitContext gb;
+    int ret, prev = 0x80, A = 0, B = 0;
+    const int pred = ctx->frame_pred;
+    uint8_t *dest;
+    int32_t slice_data_start, slice_data_end, slice_size;
+
+    slice_rows(ctx, plane_no, height, slice, &sstart, &send);
+    dest = dst + sstart * stride;
+
+    if (p->fsym >= 0) { // build_huff reported a symbol to fill slices with
+        // every row has the same residuals, only the prediction runs
+        memset(buf, p->fsym, width);
+
+        for (j = sstart; j < send; j++) {
+            restore_row(
+                pred, j - sstart, dest, stride, buf, width,
+                &prev, &A, &B
+            );
+            dest += stride;
+        }
+        return 0;
+    }
+
+    // slice offset and size validation was done earlier
+    slice_data_start = slice ? READ_U32(p->src + slice * 4 - 4) : 0;
+    slice_data_end   = READ_U32(p->src + slice * 4);
+    slice_size       = slice_data_end - slice_data_start;
+
+    if (!slice_size) {
+        return AVERROR_INVALIDDATA;
+    }
+
+    // ???
+    // The VLC is in Big Endian, so we need to reverse the byte order.
+    // So they code it like:
+    // The comand is 0x1234, so we have [0x34, 0x12], but we wanna go BE, so we have [0x12, 0x34]
+    // Then we have to decode it, that's why we:
+    //
+    // Add padding 0-bytes to the end of the slice buffer.
+    // Put the slice data into 32-bit integers.
+    // Reverse the byte order of the integers, so the bits are in the same order as in the memory.
+    // Initialize the bitstream reader.
+    // Ex:
+    // [0x0A, 0x0B, 0x0C, 0x0D, | 0x0E, 0x0F, 0x10, 0x11, | 0x01, 0x02, 0x03, 0x04]
+    // ->
+    // [0x0D0C0B0A, | 0x11100F0E, | 0x04030201]
+    //
+    // Then we read the bits as 64-bit integers, thus reversing the int32 order.
+    // Ex:
+    // ->
+    // [0x11'10'0F'0E|0D'0C'0B'0A, | 0x04'03'02'01|00'00'00'00]
+    //
+    // After the int64 read, we can read the bits and we read them from the end.
+    // Ex:
+    // Read 11 bits from 0x11'10'0F'0E|0D'0C'0B'0A and we get 0x04'0B'0A
+
+    bswap_buf(
+        (uint32_t *) slice_buf,
+        (uint32_t *)(p->src + slice_data_start + ctx->slices * 4),
+        (slice_data_end - slice_data_start + 3) >> 2
+    );
+    // Valid slices only read into the zeroed padding, corrupt ones are
+    // caught once per row, within the row margin reserved in decode_frame
+    memset(slice_buf + ((slice_size + 3) & ~3), 0, AV_INPUT_BUFFER_PADDING_SIZE);
+    if (bits_init(&gb, slice_buf, (uint32_t)slice_size << 3) < 0)
+        return AVERROR_INVALIDDATA;
+
+    for (j = sstart; j < send; j++) {
+        i = 0;
+        while(i < (width - PLANE_END_PAD)) {
+            ret = vlc_read_multi(
+                &gb,
+                buf + i,
+                p->multi.table,
+                p->vlc.table
+            );
+
+            i += ret;
+            
+            if (ret <= 0)
+                return AVERROR_INVALIDDATA;
+        }
+        for (; i < width; i++)
+            buf[i] = vlc_read(&gb, p->vlc.table);
+
+        if (bits_get_left(&gb) < 0) {
+            log_info("Slice decoding ran out of bits\n");
+            return AVERROR_INVALIDDATA;
+        }
+        
+        restore_row(
+            pred, j - sstart, dest, stride, buf, width,
+            &prev, &A, &B
+        );
+        dest += stride;
+    }
+
+    return 0;
+}
+
+/**
+ * Decode the slices of a band in every plane.
+ * @returns 0 or the error of the first slice that failed
+ */
+static int decode_band(
+    const VideoContext *ctx, const PlaneVLC *vlcs, int slice,
+    uint8_t *slice_buf, uint8_t *row_buf
+) {
+    int ret;
+
+    for (int i = 0; i < ctx->planes; i++) {
+        ret = decode_slice(
+            ctx, i, &vlcs[i], slice_buf, row_buf,
+            ctx->frame_data[i], ctx->linesize[i],
+            ctx->plane_w[i], ctx->plane_h[i], slice
+        );
+        if (ret)
+            return ret;
+    }
+    return 0;
+}
+
+typedef struct SliceJob {
+    const VideoContext *ctx;
+    const PlaneVLC *vlcs;
+    uint8_t *slice_buf;
+    uint8_t *row_buf;
+    int *status;    // per band, 0 or the error of a slice
+    int *next;      // next slice to claim, shared by the jobs
+    int stop;       // the frame fails at the first error, no concealing
+} SliceJob;
+
+static void slice_worker(void *arg)
+{
+    SliceJob *job = arg;
+    const VideoContext *ctx = job->ctx;
+    const int units = ctx->slices * ctx->planes;
+    int unit, slice, plane, ret, ok;
+
+    // Band by band, the slices of every plane of a band, alpha included,
+    // are claimed one after the other and decode alongside each other
+    while ((unit = __atomic_fetch_add(job->next, 1, __ATOMIC_RELAXED)) < units) {
+        slice = unit / ctx->planes;
+        plane = unit % ctx->planes;
+        if (video_slice_concealed(ctx, slice))
+            continue;
+        ret = decode_slice(
+            ctx, plane, &job->vlcs[plane], job->slice_buf, job->row_buf,
+            ctx->frame_data[plane], ctx->linesize[plane],
+            ctx->plane_w[plane], ctx->plane_h[plane], slice
+        );
+        if (!ret)
+            continue;
+        ok = 0;
+        __atomic_compare_exchange_n(
+            &job->status[slice], &ok, ret, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED
+        );
+        // Slices are claimed in order, those before a failed one are
+        // finished anyway, those after it aren't needed
+        if (job->stop)
+            __atomic_store_n(job->next, units, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * Decode the slices on ctx->threads jobs of the shared scheduler, the
+ * calling thread running one of them, and wait for them.
+ * @param slice_size what each job needs for a byte swapped slice
+ * @returns 0 with status set per band, or AVERROR(ENOMEM)
+ */
+static int decode_slices(
+    VideoContext *ctx, const PlaneVLC *vlcs, size_t slice_size, int stop, int *status
+) {
+    SliceJob jobs[SLICE_MAX_JOBS];
+    const int n = MIN(MIN(ctx->threads, (int)ctx->slices * ctx->planes), SLICE_MAX_JOBS);
+    // A slice buffer and its padding, then a row buffer, for each job
+    const size_t slice_stride = JOB_ALIGN(slice_size + AV_INPUT_BUFFER_PADDING_SIZE);
+    const size_t job_stride = slice_stride + JOB_ALIGN(ctx->w + 8);
+    int next = 0, ret;
+
+    ret = av_fast_padded_mallocz(&ctx->job_buf, &ctx->job_buf_size, n * job_stride);
+    if (ret)
+        return ret;
+
+    memset(status, 0, ctx->slices * sizeof(*status));
+    for (int t = 0; t < n; t++) {
+        jobs[t] = (SliceJob){
+            .ctx = ctx, .vlcs = vlcs,
+            .slice_buf = ctx->job_buf + t * job_stride,
+            .row_buf = ctx->job_buf + t * job_stride + slice_stride,
+            .status = status, .next = &next, .stop = stop,
+        };
+    }
+    // Jobs keep claiming slices, the ones that couldn't be submitted
+    // are left to the others
+    for (int t = 1; t < n; t++) {
+        if (scheduler_submit(ctx->stream, slice_worker, &jobs[t]) < 0)
+            break;
+    }
+    slice_worker(&jobs[0]);
+    scheduler_stream_wait(ctx->stream);
+    return 0;
+}
+
+// Whether slices go to the scheduler, with its stream opened on first use
+static int decode_parallel(VideoContext *ctx)
+{
+    Scheduler *s;
+
+    // A single band still has a slice per plane
+    if (ctx->threads <= 1)
+        return 0;
+    if (!ctx->stream && (s = scheduler_global()))
+        ctx->stream = scheduler_stream_open(s, SCHEDULER_WEIGHT_DEFAULT);
+    return ctx->stream != NULL;
+}
+
+#define SLICE_MARK(mask, slice) ((mask)[(slice) >> 6] |= 1ULL << ((slice) & 63))
+
+// Row y of the alpha plane, NULL without one
+static av_always_inline const uint8_t *alpha_row(const VideoContext *ctx, int y)
+{
+    return ctx->planes > UT_COLOR_PLANES ? ctx->frame_data[3] + y * ctx->linesize[3] : NULL;
+}
+
+/**
+ * Take the rows of a band from the previous frame in every plane,
+ * mid grey and opaque if there's none yet.
+ */
+static void conceal_band(VideoContext *ctx, int slice)
+{
+    int sstart, send;
+
+    for (int i = 0; i < ctx->planes; i++) {
+        size_t offset, size;
+
+        slice_rows(ctx, i, ctx->plane_h[i], slice, &sstart, &send);
+        offset = (size_t)sstart * ctx->linesize[i];
+        size   = (size_t)(send - sstart) * ctx->linesize[i];
+        if (ctx->prev_valid)
+            memcpy(ctx->frame_data[i] + offset, ctx->prev_frame_data[i] + offset, size);
+        else
+            memset(ctx->frame_data[i] + offset, i < UT_COLOR_PLANES ? 0x80 : 0xFF, size);
+    }
+}
+
+/**
+ * Reduce a band of restored slices into the preview, in place of
+ * the full size output.
+ */
+static void restore_preview(VideoContext *ctx, int slice)
+{
+    const int shift = ctx->preview_shift, round = (1 << shift) - 1;
+    int sstart, send, pstart, pend;
+
+    for (int i = 0; i < ctx->planes; i++) {
+        // The preview rows whose first row is in the band
+        slice_rows(ctx, i, ctx->plane_h[i], slice, &sstart, &send);
+        pstart = (sstart + round) >> shift;
+        pend   = (send + round) >> shift;
+
+        if (video_is_rgb(ctx)) {
+            restore_rgb_scaled(
+                ctx->frame_data[2] + (pstart << shift) * ctx->linesize[2],
+                ctx->frame_data[0] + (pstart << shift) * ctx->linesize[0],
+                ctx->frame_data[1] + (pstart << shift) * ctx->linesize[1],
+                ctx->linesize[0],
+                ctx->w, pend - pstart, shift,
+                ctx->preview_rgba + pstart * ctx->preview_w[0], ctx->preview_w[0]
+            );
+            break;
+        }
+        downscale_plane(
+            ctx->frame_data[i] + (pstart << shift) * ctx->linesize[i], ctx->linesize[i],
+            ctx->plane_w[i], pend - pstart, shift,
+            ctx->preview_data[i] + pstart * ctx->preview_w[i], ctx->preview_w[i]
+        );
+    }
+}
+
+/**
+ * Hash a band of the output. RGB rows are restored one at a time so each
+ * is hashed while still in cache, into the frame or only into hash_row.
+ */
+static void hash_band(VideoContext *ctx, int slice)
+{
+    int sstart, send;
+
+    if (video_is_rgb(ctx)) {
+        slice_rows(ctx, 0, ctx->h, slice, &sstart, &send);
+        for (int y = sstart; y < send; y++) {
+            uint32_t *row = ctx->result_frame_data
+                ? ctx->result_frame_data + y * ctx->linesize[0] : ctx->hash_row;
+
+            restore_rgb_planes(
+                ctx->frame_data[2] + y * ctx->linesize[2],
+                ctx->frame_data[0] + y * ctx->linesize[0],
+                ctx->frame_data[1] + y * ctx->linesize[1],
+                alpha_row(ctx, y),
+                ctx->linesize[0],
+                ctx->w, 1, row
+            );
+            ctx->hash_state[0] = hash_bytes((const uint8_t *)row, ctx->w * 4, ctx->hash_state[0]);
+        }
+        return;
+    }
+    for (int i = 0; i < ctx->planes; i++) {
+        slice_rows(ctx, i, ctx->plane_h[i], slice, &sstart, &send);
+        for (int y = sstart; y < send; y++) {
+            ctx->hash_state[i] = hash_bytes(
+                ctx->frame_data[i] + y * ctx->linesize[i], ctx->plane_w[i], ctx->hash_state[i]
+            );
+        }
+    }
+}
+
+int decode_frame(VideoContext * ctx, int *got_frame)
+{
+    const uint8_t *buf = ctx->packet_data;
+    int buf_size = ctx->packet_size;
+    int i, j;
+    const uint8_t *plane_start[5] = { 0 };
+    int band_status[UT_MAX_SLICES];
+    size_t slice_buf_size;
+    int plane_size, max_slice_size = 0, slice_start, slice_end, slice_size;
+    int ret, slice, ystart, yend;
+    PlaneVLC vlcs[UT_MAX_PLANES];
+    uint32_t frame_info;
+    GetByteContext gb;
+    // Set when the planes can't be located, every slice is concealed then
+    int lost = 0;
+    // Rows converted so far with YUV output
+    int yuv_rows = 0;
+    int conceal, parallel;
+
+    // No valid header yet
+    if (!ctx->planes)
+        return AVERROR(EINVAL);
+
+    // The flag only counts if the previous planes were set up with it
+    conceal = (ctx->flags & VIDEO_FLAG_CONCEAL) && ctx->prev_frame_data[0];
+    memset(ctx->slice_errors, 0, sizeof(ctx->slice_errors));
+    ctx->concealed_slices = 0;
+
+    /* parse plane structure to get frame flags and validate slice offsets */
+    bytestream_init(&gb, buf, buf_size);
+
+    for (i = 0; i < ctx->planes && !lost; i++) {
+        plane_start[i] = gb.buffer;
+        if (bytestream_get_bytes_left(&gb) < 256 + 4 * ctx->slices) {
+            log_info("Insufficient data for a plane\n");
+            if (!conceal)
+                return AVERROR_INVALIDDATA;
+            lost = 1;
+            break;
+        }
+        bytestream_skipu(&gb, 256);
+        slice_start = 0;
+        slice_end   = 0;
+        for (j = 0; j < ctx->slices; j++) {
+            slice_end   = bytestream_get_le32u(&gb);
+            if (slice_end < 0 || slice_end < slice_start ||
+                bytestream_get_bytes_left(&gb) < slice_end) {
+                log_info("Incorrect slice size\n");
+                if (!conceal)
+                    return AVERROR_INVALIDDATA;
+                // The end of a slice is where the next one starts, and
+                // the end of the last one where the next plane does
+                if (j == ctx->slices - 1) {
+                    lost = 1;
+                    break;
+                }
+                SLICE_MARK(ctx->slice_errors, j);
+                SLICE_MARK(ctx->slice_errors, j + 1);
+                continue;
+            }
+            slice_size  = slice_end - slice_start;
+            slice_start = slice_end;
+            max_slice_size = MAX(max_slice_size, slice_size);
+        }
+        plane_size = slice_end;
+        bytestream_skipu(&gb, plane_size);
+    }
+    plane_start[ctx->planes] = gb.buffer;
+
+    // The slice buffer holds one byte swapped slice at a time, plus what a
+    // corrupt slice can read past its end before the per row check. With
+    // threads every slice job has its own instead.
+    slice_buf_size = max_slice_size + 3 + SLICE_ROW_OVERREAD(ctx->w);
+    parallel = decode_parallel(ctx);
+    if (!parallel) {
+        ret = av_fast_padded_mallocz(&ctx->slice_buf, &ctx->slice_buf_size, slice_buf_size);
+        if (ret)
+            return ret;
+    }
+
+    // The frame info trails the planes, assume left prediction if it's absent
+    ctx->frame_pred = UT_PRED_LEFT;
+    if (!lost && bytestream_get_bytes_left(&gb) >= 4) {
+        frame_info = bytestream_get_le32u(&gb);
+        ctx->frame_pred = (frame_info >> 8) & 3;
+    }
+
+    memset(vlcs, 0, sizeof(vlcs));
+    for (i = 0; i < ctx->planes && !lost; i++) {
+        vlcs[i].src = plane_start[i] + 256;
+        if (build_huff(ctx, plane_start[i], &vlcs[i].vlc, &vlcs[i].multi, &vlcs[i].fsym)) {
+            if (!conceal) {
+                ret = AVERROR_INVALIDDATA;
+                goto end;
+            }
+            // A plane without tables has no slice to decode
+            lost = 1;
+        }
+    }
+    if (lost) {
+        for (slice = 0; slice < ctx->slices; slice++)
+            SLICE_MARK(ctx->slice_errors, slice);
+    }
+
+    // Decode into the older planes, the previous frame stays intact
+    // for the slices to be concealed
+    if (conceal) {
+        for (i = 0; i < ctx->planes; i++) {
+            uint8_t *tmp = ctx->frame_data[i];
+            ctx->frame_data[i] = ctx->prev_frame_data[i];
+            ctx->prev_frame_data[i] = tmp;
+        }
+    }
+
+    // Each plane is hashed as one sequence of rows
+    for (i = 0; i < UT_COLOR_PLANES; i++)
+        ctx->hash_state[i] = 0;
+
+    // Slices are independent, with threads the bands are decoded at once
+    // and restored afterwards
+    if (parallel) {
+        ret = decode_slices(ctx, vlcs, slice_buf_size, !conceal, band_status);
+        if (ret)
+            goto end;
+    }
+
+    // Otherwise decoding them band by band across the planes finishes the
+    // output top to bottom, so a band can be handed out early
+    for (slice = 0; slice < ctx->slices; slice++) {
+        int bad = video_slice_concealed(ctx, slice);
+
+        if (!bad) {
+            ret = parallel ? band_status[slice]
+                : decode_band(ctx, vlcs, slice, ctx->slice_buf, ctx->vlc_buf);
+            if (ret) {
+                if (!conceal)
+                    goto end;
+                SLICE_MARK(ctx->slice_errors, slice);
+                bad = 1;
+            }
+        }
+        if (bad) {
+            conceal_band(ctx, slice);
+            ctx->concealed_slices++;
+        }
+
+        // The chroma slices of a band cover the same output rows
+        slice_rows(ctx, 0, ctx->h, slice, &ystart, &yend);
+
+        // YUV planes are the output as is
+        if (ctx->preview_shift) {
+            restore_preview(ctx, slice);
+        } else if (ctx->flags & VIDEO_FLAG_HASH) {
+            hash_band(ctx, slice);
+        } else if (ctx->yuv_data[0]) {
+            // The chroma takes rows in pairs, an odd last row of a band
+            // waits for the next one
+            ystart = yuv_rows;
+            if (yend < ctx->h)
+                yend &= ~1;
+            if (yend > ystart) {
+                rgb_planes_to_yuv420(
+                    ctx->frame_data[2] + ystart * ctx->linesize[2],
+                    ctx->frame_data[0] + ystart * ctx->linesize[0],
+                    ctx->frame_data[1] + ystart * ctx->linesize[1],
+                    ctx->linesize[0],
+                    ctx->w, yend - ystart, ctx->output_matrix,
+                    ctx->yuv_data[0] + ystart * ctx->yuv_linesize[0], ctx->yuv_linesize[0],
+                    ctx->yuv_data[1] + (ystart >> 1) * ctx->yuv_linesize[1],
+                    ctx->yuv_data[2] ? ctx->yuv_data[2] + (ystart >> 1) * ctx->yuv_linesize[2] : NULL,
+                    ctx->yuv_linesize[1]
+                );
+                yuv_rows = yend;
+            }
+        } else if (ctx->tensor_data && ctx->output_format == UT_OUTPUT_FLOAT) {
+            rgb_planes_to_float(
+                ctx->frame_data[2] + ystart * ctx->linesize[2],
+                ctx->frame_data[0] + ystart * ctx->linesize[0],
+                ctx->frame_data[1] + ystart * ctx->linesize[1],
+                ctx->linesize[0],
+                ctx->w, yend - ystart, ctx->output_scale, ctx->output_offset,
+                (float *)ctx->tensor_data + (size_t)ystart * ctx->w, (ptrdiff_t)ctx->w * ctx->h
+            );
+        } else if (ctx->tensor_data) {
+            rgb_planes_to_half(
+                ctx->frame_data[2] + ystart * ctx->linesize[2],
+                ctx->frame_data[0] + ystart * ctx->linesize[0],
+                ctx->frame_data[1] + ystart * ctx->linesize[1],
+                ctx->linesize[0],
+                ctx->w, yend - ystart, ctx->output_scale, ctx->output_offset,
+                (uint16_t *)ctx->tensor_data + (size_t)ystart * ctx->w, (ptrdiff_t)ctx->w * ctx->h
+            );
+        } else if (ctx->result_frame_data) {
+            restore_rgb_planes(
+                ctx->frame_data[2] + ystart * ctx->linesize[2],
+                ctx->frame_data[0] + ystart * ctx->linesize[0],
+                ctx->frame_data[1] + ystart * ctx->linesize[1],
+                alpha_row(ctx, ystart),
+                ctx->linesize[0],
+                ctx->w, yend - ystart,
+                ctx->result_frame_data + ystart * ctx->linesize[0]
+            );
+        }
+
+        if (ctx->band_callback && yend > ystart)
+            ctx->band_callback(ctx->band_opaque, ctx, ystart, yend - ystart);
+    }
+    if (conceal)
+        ctx->prev_valid = 1;
+    if (ctx->flags & VIDEO_FLAG_HASH) {
+        ctx->frame_hash = hash_bytes(
+            (const uint8_t *)ctx->hash_state, sizeof(ctx->hash_state), ctx->planes
+        );
+    }
+
+    *got_frame = 1;
+
+    /* always report that the buffer was completely consumed */
+    log_info("OK\n");
+    ret = buf_size;
+end:
+    for (i = 0; i < ctx->planes; i++) {
+        vlc_free(&vlcs[i].vlc);
+        vlc_free_multi(&vlcs[i].multi);
+    }
+    return ret;
+}
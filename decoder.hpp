@@ -0,0 +1,275 @@
+#ifndef __UT_DECODER_HPP__
+#define __UT_DECODER_HPP__
+
+// Header-only C++17 layer over the decoder: a movable Decoder owning its
+// context, packets taken as byte spans and frames handed out as
+// non-owning strided views. Nothing is copied or allocated per frame.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+#if __cplusplus >= 202002L && __has_include(<span>)
+    #include <span>
+#endif
+
+extern "C" {
+#include "video.h"
+
+// decoder.h pulls in the bit reader, which isn't C++
+int decode_frame(VideoContext * ctx, int * got_frame);
+}
+
+
+namespace ut {
+
+#if __cplusplus >= 202002L && defined(__cpp_lib_span)
+template <class T>
+using span = std::span<T>;
+#else
+// The part of std::span the decoder needs, until C++20
+template <class T>
+class span {
+public:
+    constexpr span() noexcept = default;
+    constexpr span(T * data, std::size_t size) noexcept : data_(data), size_(size) {}
+    template <class C, class = std::enable_if_t<
+        std::is_convertible_v<decltype(std::declval<C &>().data()), T *>>>
+    constexpr span(C & c) noexcept : data_(c.data()), size_(c.size()) {}
+    template <class U, class = std::enable_if_t<std::is_convertible_v<U (*)[], T (*)[]>>>
+    constexpr span(const span<U> & s) noexcept : data_(s.data()), size_(s.size()) {}
+
+    constexpr T * data() const noexcept { return data_; }
+    constexpr std::size_t size() const noexcept { return size_; }
+    constexpr std::size_t size_bytes() const noexcept { return size_ * sizeof(T); }
+    constexpr bool empty() const noexcept { return !size_; }
+    constexpr T & operator[](std::size_t i) const noexcept { return data_[i]; }
+    constexpr T * begin() const noexcept { return data_; }
+    constexpr T * end() const noexcept { return data_ + size_; }
+
+private:
+    T * data_ = nullptr;
+    std::size_t size_ = 0;
+};
+#endif
+
+/**
+ * Rows of one plane, stride elements apart.
+ */
+template <class T>
+struct PlaneView {
+    T * data = nullptr;
+    int width = 0;
+    int height = 0;
+    std::ptrdiff_t stride = 0;
+
+    T * row(int y) const noexcept { return data + y * stride; }
+    span<T> row_span(int y) const noexcept { return { row(y), static_cast<std::size_t>(width) }; }
+    explicit operator bool() const noexcept { return data != nullptr; }
+};
+
+/**
+ * The output of the last decoded packet, valid until the next decode.
+ * Which members are set follows the stream and the output options:
+ * rgba for RGB, planes for YUV streams, YUV output (NV12 has an empty
+ * planes[2]) and previews of YUV, tensor for float and half output.
+ */
+struct Frame {
+    int format = 0;         // UT_FMT_*
+    int width = 0;
+    int height = 0;
+    PlaneView<const uint32_t> rgba;
+    PlaneView<const uint8_t> planes[UT_COLOR_PLANES];
+    span<const std::byte> tensor;
+    uint64_t hash = 0;      // with VIDEO_FLAG_HASH
+    uint32_t concealed_slices = 0;
+};
+
+/**
+ * Views of the output in a context, see Frame.
+ */
+inline Frame frame_view(const VideoContext & ctx) noexcept {
+    Frame f;
+
+    f.format = ctx.format;
+    f.width = ctx.w;
+    f.height = ctx.h;
+    f.hash = ctx.frame_hash;
+    f.concealed_slices = ctx.concealed_slices;
+    if (!ctx.planes)
+        return f;
+
+    if (ctx.preview_shift) {
+        f.width = ctx.preview_w[0];
+        f.height = ctx.preview_h[0];
+        if (ctx.preview_rgba) {
+            f.rgba = { ctx.preview_rgba, ctx.preview_w[0], ctx.preview_h[0], ctx.preview_w[0] };
+            return f;
+        }
+        for (int i = 0; i < ctx.planes; i++)
+            f.planes[i] = { ctx.preview_data[i], ctx.preview_w[i], ctx.preview_h[i], ctx.preview_w[i] };
+    } else if (ctx.tensor_data) {
+        f.tensor = { static_cast<const std::byte *>(ctx.tensor_data), ctx.tensor_size };
+    } else if (ctx.yuv_data[0]) {
+        for (int i = 0; i < UT_COLOR_PLANES && ctx.yuv_data[i]; i++) {
+            const int h = i ? (ctx.h + 1) >> 1 : ctx.h;
+            f.planes[i] = { ctx.yuv_data[i], ctx.yuv_linesize[i], h, ctx.yuv_linesize[i] };
+        }
+    } else if (video_is_rgb(&ctx)) {
+        if (ctx.result_frame_data)
+            f.rgba = { ctx.result_frame_data, ctx.w, ctx.h, ctx.linesize[0] };
+    } else {
+        for (int i = 0; i < ctx.planes; i++)
+            f.planes[i] = { ctx.frame_data[i], ctx.plane_w[i], ctx.plane_h[i], ctx.linesize[i] };
+    }
+    return f;
+}
+
+/**
+ * Owns a VideoContext. Errors are the negative AVERROR codes of the C API,
+ * nothing throws.
+ */
+class Decoder {
+public:
+    // What is set on the context before the first header
+    struct Options {
+        int flags = 0;                      // VIDEO_FLAG_*
+        int output_format = UT_OUTPUT_RGBA;
+        int output_matrix = UT_MATRIX_BT601;
+        int preview_shift = 0;
+        float scale[UT_COLOR_PLANES] = {};  // for float and half output
+        float offset[UT_COLOR_PLANES] = {};
+        const VideoAllocator * allocator = nullptr;
+    };
+
+    Decoder() noexcept : Decoder(Options()) {}
+
+    explicit Decoder(const Options & o) noexcept : ctx_() {
+        ctx_.flags = o.flags;
+        ctx_.output_format = static_cast<uint8_t>(o.output_format);
+        ctx_.output_matrix = static_cast<uint8_t>(o.output_matrix);
+        ctx_.preview_shift = static_cast<uint8_t>(o.preview_shift);
+        std::memcpy(ctx_.output_scale, o.scale, sizeof(o.scale));
+        std::memcpy(ctx_.output_offset, o.offset, sizeof(o.offset));
+        ctx_.allocator = o.allocator;
+    }
+
+    // The buffers move along, the context has no pointers into itself
+    Decoder(Decoder && other) noexcept : ctx_(other.ctx_) { other.ctx_ = VideoContext(); }
+
+    Decoder & operator=(Decoder && other) noexcept {
+        if (this != &other) {
+            video_free(&ctx_);
+            ctx_ = other.ctx_;
+            other.ctx_ = VideoContext();
+        }
+        return *this;
+    }
+
+    Decoder(const Decoder &) = delete;
+    Decoder & operator=(const Decoder &) = delete;
+
+    ~Decoder() { video_free(&ctx_); }
+
+    /**
+     * Set up from a stream header, the bytes after HEADER_END_KEY.
+     */
+    int header(span<const std::byte> data) noexcept {
+        // Only read, the C signature predates const
+        return video_from_data(&ctx_, bytes(data), static_cast<uint32_t>(data.size()));
+    }
+
+    /**
+     * Decode a packet in place. Like VideoPacket, the packet must be
+     * followed by AV_INPUT_BUFFER_PADDING_SIZE readable bytes.
+     * @param frame set to the output if not null
+     */
+    int decode(span<const std::byte> packet, Frame * frame = nullptr) noexcept {
+        uint8_t * own = ctx_.packet_data;
+        uint32_t own_size = ctx_.packet_size;
+        int got_frame = 0, ret;
+
+        if (!ctx_.planes)
+            return AVERROR(EINVAL);
+        ctx_.packet_data = bytes(packet);
+        ctx_.packet_size = static_cast<uint32_t>(packet.size());
+        ret = decode_frame(&ctx_, &got_frame);
+        ctx_.packet_data = own;
+        ctx_.packet_size = own_size;
+
+        if (ret >= 0 && frame)
+            *frame = this->frame();
+        return ret < 0 ? ret : 0;
+    }
+
+    /**
+     * Bytes decode_into() needs: RGBA rows linesize apart for RGB, the
+     * planes back to back for YUV, 0 when the output can't go there
+     * (previews, other output formats, YUV with concealment).
+     */
+    std::size_t frame_size() const noexcept {
+        std::size_t size = 0;
+
+        if (!ctx_.planes || ctx_.preview_shift)
+            return 0;
+        if (video_is_rgb(&ctx_))
+            return ctx_.result_frame_data ? static_cast<std::size_t>(ctx_.linesize[0]) * ctx_.h * 4 : 0;
+        if (ctx_.flags & VIDEO_FLAG_CONCEAL)
+            return 0;
+        for (int i = 0; i < ctx_.planes; i++)
+            size += static_cast<std::size_t>(ctx_.linesize[i]) * ctx_.plane_h[i];
+        return size;
+    }
+
+    /**
+     * Decode a packet straight into caller memory of frame_size() bytes,
+     * at least 4-byte aligned, the frame views then point there.
+     */
+    int decode_into(span<const std::byte> packet, span<std::byte> out, Frame * frame = nullptr) noexcept {
+        const std::size_t size = frame_size();
+        uint8_t * own[UT_MAX_PLANES];
+        uint32_t * own_rgba = ctx_.result_frame_data;
+        uint8_t * p = reinterpret_cast<uint8_t *>(out.data());
+        int ret;
+
+        if (!size || out.size() < size)
+            return AVERROR(EINVAL);
+
+        std::memcpy(own, ctx_.frame_data, sizeof(own));
+        if (video_is_rgb(&ctx_)) {
+            ctx_.result_frame_data = reinterpret_cast<uint32_t *>(p);
+        } else {
+            for (int i = 0; i < ctx_.planes; i++) {
+                ctx_.frame_data[i] = p;
+                p += static_cast<std::size_t>(ctx_.linesize[i]) * ctx_.plane_h[i];
+            }
+        }
+        ret = decode(packet, frame);
+        std::memcpy(ctx_.frame_data, own, sizeof(own));
+        ctx_.result_frame_data = own_rgba;
+        return ret;
+    }
+
+    /**
+     * Views of the last output, in decoder memory unless it was decoded
+     * with decode_into() (then the views are only set by that call).
+     */
+    Frame frame() const noexcept { return frame_view(ctx_); }
+
+    // The C context, for what the wrapper doesn't cover
+    VideoContext & context() noexcept { return ctx_; }
+    const VideoContext & context() const noexcept { return ctx_; }
+
+private:
+    static uint8_t * bytes(span<const std::byte> s) noexcept {
+        return const_cast<uint8_t *>(reinterpret_cast<const uint8_t *>(s.data()));
+    }
+
+    VideoContext ctx_;
+};
+
+} // namespace ut
+
+
+#endif // __UT_DECODER_HPP__
@@ -23,9 +23,45 @@
 #define AV_INPUT_BUFFER_PADDING_SIZE 64
 
 #define UT_COLOR_PLANES 3
+// The color planes and the alpha plane of ULRA
+#define UT_MAX_PLANES 4
+#define UT_MAX_SLICES 256
 #define UT_MAX_VLC_DEPTH 3
 #define UT_VLC_BITS 11
 #define UT_HUFF_ELEMS 256
 #define UT_VLC_SYMBOLS_SIZE 2
 
+// Stream pixel formats, mapped from the FourCC in the stream header
+enum {
+    UT_FMT_RGB = 0, // ULRG, G/B/R planes restored to packed RGBA
+    UT_FMT_YUV420,  // ULY0, planar Y/U/V with half width and height chroma
+    UT_FMT_YUV422,  // ULY2, planar Y/U/V with half width chroma
+    UT_FMT_YUV444,  // ULY4, planar Y/U/V
+    UT_FMT_RGBA,    // ULRA, G/B/R planes and an alpha plane restored to packed RGBA
+};
+
+// What RGB streams are restored to
+enum {
+    UT_OUTPUT_RGBA = 0,
+    UT_OUTPUT_YUV420,   // limited range planar Y/U/V with half width and height chroma
+    UT_OUTPUT_NV12,     // the same with U and V interleaved in one plane
+    UT_OUTPUT_FLOAT,    // float R, G and B planes one after the other (CHW)
+    UT_OUTPUT_HALF,     // the same as IEEE half floats
+    UT_OUTPUT_NONE,     // the planes only, for VIDEO_FLAG_HASH
+};
+
+// YUV matrices for the RGB conversion
+enum {
+    UT_MATRIX_BT601 = 0,
+    UT_MATRIX_BT709,
+};
+
+// Frame prediction modes, stored in bits 8-9 of the frame info
+enum {
+    UT_PRED_NONE = 0,
+    UT_PRED_LEFT,
+    UT_PRED_GRADIENT,
+    UT_PRED_MEDIAN,
+};
+
 #endif
@@ -0,0 +1,145 @@
+#include "demuxer.h"
+#include "decoder.h"
+#include "defs.h"
+#include "utils.h"
+#include <stdint.h>
+#include <string.h>
+
+
+/**
+ * A short read ends the stream, the source tells why.
+ * @returns 1, 0 at the end of the stream or a negative AVERROR
+ */
+static int read_full(Demuxer * d, void * dst, size_t size) {
+    if (source_read(d->src, dst, size) == size)
+        return 1;
+    d->ended = 1;
+    return source_error(d->src);
+}
+
+static int skip_full(Demuxer * d, size_t size) {
+    if (source_skip(d->src, size) == size)
+        return 1;
+    d->ended = 1;
+    return source_error(d->src);
+}
+
+/**
+ * Read the header following HEADER_START_KEY.
+ * @returns 1, 0 at the end of the stream or a negative AVERROR
+ */
+static int demuxer_read_header(Demuxer * d) {
+    VideoContext * ctx = &d->video;
+    uint8_t * buf = d->buf;
+    const VideoContext old = *ctx;
+    uint8_t size;
+    int ret;
+
+    // Header size and end-key
+    if ((ret = read_full(d, buf, sizeof(uint8_t) + sizeof(uint16_t))) <= 0)
+        return ret;
+
+    if (READ_U16(buf + 1) != HEADER_END_KEY) {
+        // Not a video header
+        return 1;
+    }
+
+    size = *buf;
+    if ((ret = read_full(d, buf, size)) <= 0)
+        return ret;
+
+    d->headers++;
+    if (video_from_data(ctx, buf, size) < 0) {
+        log_info("Invalid header\n");
+        return 1;
+    }
+    if (!old.planes || old.w != ctx->w || old.h != ctx->h || old.format != ctx->format)
+        d->reinits++;
+
+    return 1;
+}
+
+
+void demuxer_init(Demuxer * d, PacketSource * src) {
+    memset(d, 0, sizeof(*d));
+    d->src = src;
+}
+
+int demuxer_read_frame(Demuxer * d) {
+    VideoContext * ctx = &d->video;
+    uint8_t * buf = d->buf;
+    uint32_t size;
+    int got_frame = 0;
+    int ret;
+
+    if (d->ended)
+        return 0;
+
+    // Find a packet
+    while (1) {
+        // Read the start key
+        if ((ret = read_full(d, buf, sizeof(uint32_t))) <= 0)
+            return ret;
+        log_info("Key: %x\n", READ_U32(buf));
+
+        if (READ_U32(buf) == HEADER_START_KEY) {
+            if ((ret = demuxer_read_header(d)) <= 0)
+                return ret;
+            continue;
+        }
+
+        if (READ_U32(buf) != PACKET_START_KEY)
+            continue;
+
+        // Header size and end-key
+        if ((ret = read_full(d, buf, sizeof(uint8_t) + sizeof(uint16_t))) <= 0)
+            return ret;
+        log_info("Header size: %d\n", *buf);
+
+        // Not a video packet, or too short a header to hold the payload size
+        if (READ_U16(buf + 1) != PACKET_END_KEY || *buf < sizeof(uint32_t))
+            continue;
+
+        // Read the header data
+        if ((ret = read_full(d, buf, *buf)) <= 0)
+            return ret;
+        size = READ_U32(buf);
+        log_info("Data size: %u\n", size);
+
+        // Unwanted packets are passed over by size, the payload isn't read
+        if (!ctx->planes || (d->step > 1 && d->packets % d->step)) {
+            if ((ret = skip_full(d, size)) <= 0)
+                return ret;
+            if (!ctx->planes)
+                log_info("Packet before a valid header, skipped\n");
+            d->packets++;
+            d->skipped++;
+            continue;
+        }
+
+        // A corrupt size, look for the next key right after it instead
+        // of reading or skipping what could be most of the file
+        if (!video_packet_size_valid(ctx, size)) {
+            log_info("Packet size %u too large for the frame\n", size);
+            continue;
+        }
+
+        if ((ret = video_packet_alloc(ctx, size)) < 0)
+            return ret;
+        if ((ret = read_full(d, ctx->packet_data, ctx->packet_size)) <= 0)
+            return ret;
+        d->packets++;
+        break;
+    }
+
+    if ((ret = decode_frame(ctx, &got_frame)) < 0) {
+        log_info("Error decoding frame: %d\n", ret);
+        return ret;
+    }
+
+    return got_frame;
+}
+
+void demuxer_free(Demuxer * d) {
+    video_free(&d->video);
+}
@@ -0,0 +1,59 @@
+#ifndef __UT_DEMUXER_H__
+#define __UT_DEMUXER_H__
+
+#include "source.h"
+#include "video.h"
+#include <stdint.h>
+
+#define HEADER_START_KEY 0xF0FF00F0
+#define HEADER_END_KEY 0x7FF1
+
+#define PACKET_START_KEY 0xFFF0F0F0
+#define PACKET_END_KEY 0xF0F1
+
+
+/**
+ * Splits a stream into headers and packets and decodes the packets.
+ *
+ * Instances are independent, the buffers live in the video context and
+ * are only replaced when a header changes the frame size or format.
+ */
+typedef struct Demuxer {
+    PacketSource * src;
+    VideoContext video;
+
+    // Decode one packet in step, every packet if 0 or 1
+    uint32_t step;
+
+    // Set once a read came up short, at the end or on an error
+    int ended;
+
+    // Headers and packets seen so far, for statistics
+    uint32_t headers;
+    uint32_t reinits;
+    uint32_t packets;
+    uint32_t skipped;
+
+    uint8_t buf[256];
+} Demuxer;
+
+
+/**
+ * @param src stays owned by the caller
+ */
+void demuxer_init(Demuxer * d, PacketSource * src);
+
+/**
+ * Read up to the next packet and decode it into d->video.
+ * Packets before the first valid header, and those step leaves out, are
+ * skipped without reading their payload.
+ * @returns 1 with a frame decoded, 0 at the end of the stream,
+ *          a negative AVERROR if decoding, allocating or reading failed.
+ *          A read error is returned once, the stream ends with it.
+ */
+int demuxer_read_frame(Demuxer * d);
+
+void demuxer_free(Demuxer * d);
+
+
+#endif // __UT_DEMUXER_H__
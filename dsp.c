@@ -0,0 +1,797 @@
+#include "dsp.h"
+#include "defs.h"
+#include "utils.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __SSE2__
+    #include <emmintrin.h>
+#endif
+
+// The hot kernels get an AVX2 build next to the baseline one, picked once
+// at load time through ifunc. That needs GCC (or clang) on x86-64 glibc.
+#if defined(__x86_64__) && defined(__GNUC__) && defined(__GLIBC__) && !defined(UT_NO_MULTIVERSION)
+    #define UT_MULTIVERSION 1
+    #include <immintrin.h>
+    #define av_target_clones __attribute__((target_clones("default", "avx2")))
+    #define av_target_avx2 __attribute__((target("avx2")))
+    #define av_target_avx2_f16c __attribute__((target("avx2,f16c")))
+    // Resolvers run while relocating, before any sanitizer runtime is up
+    #define av_resolver av_cold __attribute__((no_sanitize_address))
+#else
+    #define UT_MULTIVERSION 0
+    #define av_target_clones
+#endif
+
+
+static av_pure_expr int mid_pred(int a, int b, int c) {
+    if (a > b) {
+        if (c > b) {
+            if (c > a) b = a;
+            else       b = c;
+        }
+    } else {
+        if (b > c) {
+            if (c > a) b = c;
+            else       b = a;
+        }
+    }
+    return b;
+}
+
+
+#ifdef __SSE2__
+/**
+ * Running byte sum over the 16 lanes of x, starting from acc (broadcasted).
+ * Lane 0 is the leftmost pixel.
+ */
+static av_always_inline __m128i prefix_sum_epi8(__m128i x, __m128i acc) {
+    x = _mm_add_epi8(x, _mm_slli_si128(x, 1));
+    x = _mm_add_epi8(x, _mm_slli_si128(x, 2));
+    x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+    x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+    return _mm_add_epi8(x, acc);
+}
+
+/**
+ * Broadcast the last (rightmost) lane to all lanes.
+ */
+static av_always_inline __m128i broadcast_last_epi8(__m128i x) {
+    x = _mm_unpackhi_epi8(x, x);
+    x = _mm_unpackhi_epi16(x, x);
+    return _mm_shuffle_epi32(x, 0xFF);
+}
+#endif
+
+#if UT_MULTIVERSION
+/**
+ * Same as prefix_sum_epi8 for 32 lanes, the byte shifts stay within
+ * 128-bit halves, so the low half total is added to the high half after.
+ */
+static av_target_avx2 av_always_inline __m256i prefix_sum_epi8_avx2(__m256i x, __m256i acc) {
+    x = _mm256_add_epi8(x, _mm256_slli_si256(x, 1));
+    x = _mm256_add_epi8(x, _mm256_slli_si256(x, 2));
+    x = _mm256_add_epi8(x, _mm256_slli_si256(x, 4));
+    x = _mm256_add_epi8(x, _mm256_slli_si256(x, 8));
+    x = _mm256_add_epi8(x, _mm256_shuffle_epi8(
+        _mm256_permute2x128_si256(x, x, 0x08), _mm256_set1_epi8(15)
+    ));
+    return _mm256_add_epi8(x, acc);
+}
+
+static av_target_avx2 av_always_inline __m256i broadcast_last_epi8_avx2(__m256i x) {
+    return _mm256_permute4x64_epi64(_mm256_shuffle_epi8(x, _mm256_set1_epi8(15)), 0xFF);
+}
+#endif
+
+
+static int add_left_pred_base(
+    uint8_t *dst, const uint8_t *src, ptrdiff_t w, int acc
+) {
+    int i = 0;
+
+#ifdef __SSE2__
+    __m128i a = _mm_set1_epi8((char)acc), x;
+
+    for (; i + 16 <= w; i += 16) {
+        x = _mm_loadu_si128((const __m128i *)(src + i));
+        x = prefix_sum_epi8(x, a);
+        _mm_storeu_si128((__m128i *)(dst + i), x);
+        a = broadcast_last_epi8(x);
+    }
+    acc = _mm_cvtsi128_si32(a) & 0xFF;
+#else
+    if (w >= 8) {
+        for (i = 0; i < w - 7; i += 8) {
+            acc   += src[i];
+            dst[i] = acc;
+            acc   += src[i + 1];
+            dst[i + 1] = acc;
+            acc   += src[i + 2];
+            dst[i + 2] = acc;
+            acc   += src[i + 3];
+            dst[i + 3] = acc;
+            acc   += src[i + 4];
+            dst[i + 4] = acc;
+            acc   += src[i + 5];
+            dst[i + 5] = acc;
+            acc   += src[i + 6];
+            dst[i + 6] = acc;
+            acc   += src[i + 7];
+            dst[i + 7] = acc;
+        }
+    }
+#endif
+
+    for (; i < w; i++) {
+        acc   += src[i];
+        dst[i] = acc;
+    }
+
+    return acc;
+}
+
+/**
+ * Gradient prediction rewritten as a left prediction over
+ * (diff[i] + top[i] - top[i-1]), so a row is a vector subtract followed
+ * by a prefix sum.
+ * @param tl  the pixel to the left of top[0]
+ * @param acc the pixel to the left of dst[0]
+ */
+static void add_gradient_pred_base(
+    uint8_t *dst, const uint8_t *top, const uint8_t *diff, ptrdiff_t w,
+    uint8_t tl, uint8_t acc
+) {
+    int i = 0;
+
+#ifdef __SSE2__
+    __m128i a = _mm_set1_epi8((char)acc), t, x;
+
+    for (; i + 16 <= w; i += 16) {
+        t = _mm_loadu_si128((const __m128i *)(top + i));
+        x = _mm_or_si128(_mm_slli_si128(t, 1), _mm_cvtsi32_si128(tl));
+        x = _mm_add_epi8(
+            _mm_loadu_si128((const __m128i *)(diff + i)),
+            _mm_sub_epi8(t, x)
+        );
+        x = prefix_sum_epi8(x, a);
+        _mm_storeu_si128((__m128i *)(dst + i), x);
+        a  = broadcast_last_epi8(x);
+        tl = top[i + 15];
+    }
+    acc = _mm_cvtsi128_si32(a);
+#endif
+
+    for (; i < w; i++) {
+        acc   += diff[i] + top[i] - tl;
+        tl     = top[i];
+        dst[i] = acc;
+    }
+}
+
+
+#if UT_MULTIVERSION
+static av_target_avx2 int add_left_pred_avx2(
+    uint8_t *dst, const uint8_t *src, ptrdiff_t w, int acc
+) {
+    int i = 0;
+    __m256i a = _mm256_set1_epi8((char)acc), x;
+
+    for (; i + 32 <= w; i += 32) {
+        x = _mm256_loadu_si256((const __m256i *)(src + i));
+        x = prefix_sum_epi8_avx2(x, a);
+        _mm256_storeu_si256((__m256i *)(dst + i), x);
+        a = broadcast_last_epi8_avx2(x);
+    }
+    acc = _mm256_cvtsi256_si32(a) & 0xFF;
+
+    return add_left_pred_base(dst + i, src + i, w - i, acc);
+}
+
+static av_target_avx2 void add_gradient_pred_avx2(
+    uint8_t *dst, const uint8_t *top, const uint8_t *diff, ptrdiff_t w
+) {
+    int i = 1;
+    __m256i a, x;
+
+    if (w < 1)
+        return;
+
+    // the first pixel has no top-left, after it top[i - 1] can be loaded
+    dst[0] = diff[0] + top[0];
+    a = _mm256_set1_epi8((char)dst[0]);
+
+    for (; i + 32 <= w; i += 32) {
+        x = _mm256_sub_epi8(
+            _mm256_loadu_si256((const __m256i *)(top + i)),
+            _mm256_loadu_si256((const __m256i *)(top + i - 1))
+        );
+        x = _mm256_add_epi8(x, _mm256_loadu_si256((const __m256i *)(diff + i)));
+        x = prefix_sum_epi8_avx2(x, a);
+        _mm256_storeu_si256((__m256i *)(dst + i), x);
+        a = broadcast_last_epi8_avx2(x);
+    }
+
+    add_gradient_pred_base(
+        dst + i, top + i, diff + i, w - i, top[i - 1], _mm256_cvtsi256_si32(a)
+    );
+}
+
+typedef int (add_left_pred_fn)(uint8_t *, const uint8_t *, ptrdiff_t, int);
+typedef void (add_gradient_pred_fn)(uint8_t *, const uint8_t *, const uint8_t *, ptrdiff_t);
+
+static av_resolver add_left_pred_fn * resolve_add_left_pred(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? add_left_pred_avx2 : add_left_pred_base;
+}
+
+static void add_gradient_pred_sse2(
+    uint8_t *dst, const uint8_t *top, const uint8_t *diff, ptrdiff_t w
+) {
+    add_gradient_pred_base(dst, top, diff, w, 0, 0);
+}
+
+static av_resolver add_gradient_pred_fn * resolve_add_gradient_pred(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? add_gradient_pred_avx2 : add_gradient_pred_sse2;
+}
+
+int add_left_pred(uint8_t *dst, const uint8_t *src, ptrdiff_t w, int acc)
+    __attribute__((ifunc("resolve_add_left_pred")));
+
+void add_gradient_pred(uint8_t *dst, const uint8_t *top, const uint8_t *diff, ptrdiff_t w)
+    __attribute__((ifunc("resolve_add_gradient_pred")));
+
+#else
+
+int add_left_pred(uint8_t *dst, const uint8_t *src, ptrdiff_t w, int acc) {
+    return add_left_pred_base(dst, src, w, acc);
+}
+
+void add_gradient_pred(
+    uint8_t *dst, const uint8_t *top, const uint8_t *diff, ptrdiff_t w
+) {
+    add_gradient_pred_base(dst, top, diff, w, 0, 0);
+}
+
+#endif
+
+
+// The dependency on the previous output pixel can't be vectorized away
+// (a lane-serial SIMD version measured no faster), so there is a single
+// scalar version that keeps the median branchy like the reference decoder.
+void add_median_pred(
+    uint8_t *dst, const uint8_t *top, const uint8_t *diff, ptrdiff_t w,
+    int *left, int *left_top
+) {
+    int i;
+    uint8_t l, lt;
+
+    l  = *left;
+    lt = *left_top;
+
+    for (i = 0; i < w; i++) {
+        l      = mid_pred(l, top[i], (uint8_t)(l - lt + top[i])) + diff[i];
+        lt     = top[i];
+        dst[i] = l;
+    }
+
+    *left     = l;
+    *left_top = lt;
+}
+
+
+int sub_left_pred(uint8_t *diff, const uint8_t *src, ptrdiff_t w, int left) {
+    int i;
+
+    if (w < 1)
+        return left;
+
+    diff[0] = src[0] - left;
+    for (i = 1; i < w; i++)
+        diff[i] = src[i] - src[i - 1];
+
+    return src[w - 1];
+}
+
+void sub_gradient_pred(
+    uint8_t *diff, const uint8_t *top, const uint8_t *src, ptrdiff_t w
+) {
+    int i;
+
+    if (w < 1)
+        return;
+
+    diff[0] = src[0] - top[0];
+    for (i = 1; i < w; i++)
+        diff[i] = src[i] - src[i - 1] - top[i] + top[i - 1];
+}
+
+void sub_median_pred(
+    uint8_t *diff, const uint8_t *top, const uint8_t *src, ptrdiff_t w,
+    int *left, int *left_top
+) {
+    int i;
+    uint8_t l, lt;
+
+    l  = *left;
+    lt = *left_top;
+
+    for (i = 0; i < w; i++) {
+        diff[i] = src[i] - mid_pred(l, top[i], (uint8_t)(l - lt + top[i]));
+        l       = src[i];
+        lt      = top[i];
+    }
+
+    *left     = l;
+    *left_top = lt;
+}
+
+
+// Alpha is a constant in each caller, so both rows vectorize on their own
+static av_always_inline void rgb_row(
+    const uint8_t *r, const uint8_t *g, const uint8_t *b, const uint8_t *a,
+    int width, uint32_t *out
+) {
+    uint8_t g0;
+
+    for (int i = 0; i < width; i++) {
+        g0 = g[i];
+        out[i] = (a ? (uint32_t)a[i] << 24 : 0xFF000000)
+            | (uint32_t)(uint8_t)(b[i] + g0 - 0x80) << 16
+            | (uint32_t)g0 << 8
+            | (uint8_t)(r[i] + g0 - 0x80);
+    }
+}
+
+// Plain loops, the compiler vectorizes them for each of the clones
+av_target_clones void restore_rgb_planes(
+    const uint8_t *r, const uint8_t *g, const uint8_t *b, const uint8_t *a,
+    ptrdiff_t linesize,
+    int width, int height,
+    uint32_t *out
+) {
+    for (int j = 0; j < height; j++) {
+        if (a) {
+            rgb_row(r, g, b, a, width, out);
+            a += linesize;
+        } else {
+            rgb_row(r, g, b, NULL, width, out);
+        }
+        r   += linesize;
+        g   += linesize;
+        b   += linesize;
+        out += linesize;
+    }
+}
+
+// One output row of restore_rgb_scaled, the shift is a constant in each
+// caller so the box loop unrolls. R and B are summed as the 16-bit halves
+// of one word, which keeps the loop vectorizable.
+static av_always_inline void rgb_scaled_row(
+    const uint8_t *r, const uint8_t *g, const uint8_t *b,
+    int width, const int shift, uint32_t *out
+) {
+    const int n = 1 << shift, full = width >> shift, rest = width & (n - 1);
+    const uint32_t round = (n / 2) * 0x00010001;
+    uint32_t srb, sg;
+    uint8_t g0;
+
+    for (int i = 0; i < full; i++) {
+        srb = sg = 0;
+        for (int k = 0; k < n; k++) {
+            g0   = g[(i << shift) + k];
+            sg  += g0;
+            srb += (uint8_t)(r[(i << shift) + k] + g0 - 0x80)
+                 | (uint32_t)(uint8_t)(b[(i << shift) + k] + g0 - 0x80) << 16;
+        }
+        out[i] = 0xFF000000
+            | ((srb + round) >> shift & 0x00FF00FF)
+            | ((sg + n / 2) >> shift) << 8;
+    }
+    if (rest) {
+        unsigned sr = 0, sb = 0;
+
+        sg = 0;
+        for (int k = full << shift; k < width; k++) {
+            g0  = g[k];
+            sg += g0;
+            sb += (uint8_t)(b[k] + g0 - 0x80);
+            sr += (uint8_t)(r[k] + g0 - 0x80);
+        }
+        out[full] = 0xFF000000
+            | (sb + rest / 2) / rest << 16
+            | (sg + rest / 2) / rest << 8
+            | (sr + rest / 2) / rest;
+    }
+}
+
+// For pairs the deinterleaving costs more than restoring the row as is,
+// so it is restored in chunks and the neighbours are averaged after,
+// as (a + b + 1) >> 1 for each byte
+static av_always_inline void rgb_halved_row(
+    const uint8_t *r, const uint8_t *g, const uint8_t *b,
+    int width, uint32_t *out
+) {
+    uint32_t tmp[256], p, q;
+    uint8_t g0;
+
+    for (int x = 0; x < width; x += 256) {
+        const int n = MIN(256, width - x);
+
+        for (int i = 0; i < n; i++) {
+            g0 = g[x + i];
+            tmp[i] = 0xFF000000
+                | (uint32_t)(uint8_t)(b[x + i] + g0 - 0x80) << 16
+                | (uint32_t)g0 << 8
+                | (uint8_t)(r[x + i] + g0 - 0x80);
+        }
+        for (int i = 0; i < n / 2; i++) {
+            p = tmp[2 * i];
+            q = tmp[2 * i + 1];
+            out[(x >> 1) + i] = (p | q) - ((p ^ q) >> 1 & 0x7F7F7F7F);
+        }
+        // An odd width leaves the last pixel on its own
+        if (n & 1)
+            out[(x + n) >> 1] = tmp[n - 1];
+    }
+}
+
+av_target_clones void restore_rgb_scaled(
+    const uint8_t *r, const uint8_t *g, const uint8_t *b,
+    ptrdiff_t linesize,
+    int width, int height, int shift,
+    uint32_t *out, ptrdiff_t out_stride
+) {
+    const ptrdiff_t step = linesize << shift;
+
+    for (int j = 0; j < height; j++) {
+        switch (shift) {
+            case 1: rgb_halved_row(r, g, b, width, out); break;
+            case 2: rgb_scaled_row(r, g, b, width, 2, out); break;
+            default: rgb_scaled_row(r, g, b, width, 3, out); break;
+        }
+        r   += step;
+        g   += step;
+        b   += step;
+        out += out_stride;
+    }
+}
+
+static av_always_inline void plane_scaled_row(
+    const uint8_t *src, int width, const int shift, uint8_t *dst
+) {
+    const int n = 1 << shift, full = width >> shift, rest = width & (n - 1);
+    unsigned sum;
+
+    for (int i = 0; i < full; i++) {
+        sum = 0;
+        for (int k = 0; k < n; k++)
+            sum += src[(i << shift) + k];
+        dst[i] = (sum + n / 2) >> shift;
+    }
+    if (rest) {
+        sum = 0;
+        for (int k = 0; k < rest; k++)
+            sum += src[(full << shift) + k];
+        dst[full] = (sum + rest / 2) / rest;
+    }
+}
+
+av_target_clones void downscale_plane(
+    const uint8_t *src, ptrdiff_t linesize,
+    int width, int height, int shift,
+    uint8_t *dst, ptrdiff_t dst_stride
+) {
+    const ptrdiff_t step = linesize << shift;
+
+    for (int j = 0; j < height; j++) {
+        switch (shift) {
+            case 1: plane_scaled_row(src, width, 1, dst); break;
+            case 2: plane_scaled_row(src, width, 2, dst); break;
+            default: plane_scaled_row(src, width, 3, dst); break;
+        }
+        src += step;
+        dst += dst_stride;
+    }
+}
+
+// Limited range, scaled by 256: Y from R, G, B, then U and V. The chroma
+// rows are rounded to sum to 0, so grey has none.
+static const int16_t yuv_coeffs[][9] = {
+    [UT_MATRIX_BT601] = { 66, 129, 25, -38, -74, 112, 112, -94, -18 },
+    [UT_MATRIX_BT709] = { 47, 157, 16, -26, -86, 112, 112, -102, -10 },
+};
+
+// A pair of rows, or a single last one (r1 == r0 then). The chroma comes
+// from the 2x2 sums, a last single column counts twice. The outputs are
+// restrict, too many pointers for the vectorizer to check them at run time.
+static av_always_inline void yuv420_rows(
+    const uint8_t *r0, const uint8_t *g0, const uint8_t *b0,
+    const uint8_t *r1, const uint8_t *g1, const uint8_t *b1,
+    int width, const int16_t *c,
+    uint8_t * restrict y0, uint8_t * restrict y1,
+    uint8_t * restrict u, uint8_t * restrict v, const int nv12
+) {
+    const int yr = c[0], yg = c[1], yb = c[2];
+    const int ur = c[3], ug = c[4], ub = c[5];
+    const int vr = c[6], vg = c[7], vb = c[8];
+    int rs, gs, bs, i;
+
+#define RESTORED(r, g, i) (uint8_t)((r)[i] + (g)[i] - 0x80)
+#define LUMA(r, g, b, i) \
+    (yr * RESTORED(r, g, i) + yg * (g)[i] + yb * RESTORED(b, g, i) + (16 << 8) + 128) >> 8
+
+    for (i = 0; i < width; i++)
+        y0[i] = LUMA(r0, g0, b0, i);
+    if (y1) {
+        for (i = 0; i < width; i++)
+            y1[i] = LUMA(r1, g1, b1, i);
+    }
+
+    for (i = 0; i < width >> 1; i++) {
+        rs = RESTORED(r0, g0, 2 * i) + RESTORED(r0, g0, 2 * i + 1)
+           + RESTORED(r1, g1, 2 * i) + RESTORED(r1, g1, 2 * i + 1);
+        gs = g0[2 * i] + g0[2 * i + 1] + g1[2 * i] + g1[2 * i + 1];
+        bs = RESTORED(b0, g0, 2 * i) + RESTORED(b0, g0, 2 * i + 1)
+           + RESTORED(b1, g1, 2 * i) + RESTORED(b1, g1, 2 * i + 1);
+        if (nv12) {
+            u[2 * i]     = (ur * rs + ug * gs + ub * bs + (128 << 10) + 512) >> 10;
+            u[2 * i + 1] = (vr * rs + vg * gs + vb * bs + (128 << 10) + 512) >> 10;
+        } else {
+            u[i] = (ur * rs + ug * gs + ub * bs + (128 << 10) + 512) >> 10;
+            v[i] = (vr * rs + vg * gs + vb * bs + (128 << 10) + 512) >> 10;
+        }
+    }
+    if (width & 1) {
+        i  = width - 1;
+        rs = 2 * (RESTORED(r0, g0, i) + RESTORED(r1, g1, i));
+        gs = 2 * (g0[i] + g1[i]);
+        bs = 2 * (RESTORED(b0, g0, i) + RESTORED(b1, g1, i));
+        i >>= 1;
+        if (nv12) {
+            u[2 * i]     = (ur * rs + ug * gs + ub * bs + (128 << 10) + 512) >> 10;
+            u[2 * i + 1] = (vr * rs + vg * gs + vb * bs + (128 << 10) + 512) >> 10;
+        } else {
+            u[i] = (ur * rs + ug * gs + ub * bs + (128 << 10) + 512) >> 10;
+            v[i] = (vr * rs + vg * gs + vb * bs + (128 << 10) + 512) >> 10;
+        }
+    }
+#undef LUMA
+#undef RESTORED
+}
+
+av_target_clones void rgb_planes_to_yuv420(
+    const uint8_t *r, const uint8_t *g, const uint8_t *b,
+    ptrdiff_t linesize,
+    int width, int height, int matrix,
+    uint8_t *y, ptrdiff_t y_stride,
+    uint8_t *u, uint8_t *v, ptrdiff_t c_stride
+) {
+    const int16_t *c = yuv_coeffs[matrix];
+
+    for (int j = 0; j < height; j += 2) {
+        // The second row of the last pair may be missing
+        const ptrdiff_t l1 = j + 1 < height ? linesize : 0;
+        uint8_t *y1 = j + 1 < height ? y + y_stride : NULL;
+
+        if (v)
+            yuv420_rows(r, g, b, r + l1, g + l1, b + l1, width, c, y, y1, u, v, 0);
+        else
+            yuv420_rows(r, g, b, r + l1, g + l1, b + l1, width, c, y, y1, u, NULL, 1);
+        r += 2 * linesize;
+        g += 2 * linesize;
+        b += 2 * linesize;
+        y += 2 * y_stride;
+        u += c_stride;
+        if (v)
+            v += c_stride;
+    }
+}
+
+// Round to nearest even, out of range values go to infinity and the small
+// ones to denormals. Written with masks so the callers vectorize.
+static av_always_inline uint16_t float_to_half(float f) {
+    const union { uint32_t u; float f; } magic = { .u = ((127 - 15) + (23 - 10) + 1) << 23 };
+    union { uint32_t u; float f; } x = { .f = f }, d;
+    const uint32_t sign = x.u & 0x80000000;
+    uint32_t h, n, small, big;
+
+    x.u ^= sign;
+    // Denormals come out of the mantissa once added to the magic value
+    d.f = x.f + magic.f;
+    n = x.u + ((uint32_t)(15 - 127) << 23) + 0xFFF + ((x.u >> 13) & 1);
+    small = -(uint32_t)(x.u < 113u << 23);
+    big   = -(uint32_t)(x.u >= (127u + 16) << 23);
+    h = ((d.u - magic.u) & small) | ((n >> 13) & ~small);
+    h = (0x7C00 & big) | (h & ~big);
+    return h | sign >> 16;
+}
+
+// One row of each output plane, restrict as the planes are one buffer
+#define TENSOR_ROW(name, type, convert)                                        \
+static av_always_inline void name(                                             \
+    const uint8_t *r, const uint8_t *g, const uint8_t *b, int width,           \
+    const float *scale, const float *offset,                                   \
+    type * restrict dr, type * restrict dg, type * restrict db                 \
+) {                                                                            \
+    const float sr = scale[0], sg = scale[1], sb = scale[2];                   \
+    const float offr = offset[0], offg = offset[1], offb = offset[2];          \
+                                                                               \
+    for (int i = 0; i < width; i++) {                                          \
+        dr[i] = convert((uint8_t)(r[i] + g[i] - 0x80) * sr + offr);            \
+        dg[i] = convert(g[i] * sg + offg);                                     \
+        db[i] = convert((uint8_t)(b[i] + g[i] - 0x80) * sb + offb);            \
+    }                                                                          \
+}
+
+TENSOR_ROW(float_row, float, )
+TENSOR_ROW(half_row, uint16_t, float_to_half)
+
+#undef TENSOR_ROW
+
+av_target_clones void rgb_planes_to_float(
+    const uint8_t *r, const uint8_t *g, const uint8_t *b,
+    ptrdiff_t linesize,
+    int width, int height,
+    const float *scale, const float *offset,
+    float *out, ptrdiff_t plane_size
+) {
+    for (int j = 0; j < height; j++) {
+        float_row(r, g, b, width, scale, offset, out, out + plane_size, out + 2 * plane_size);
+        r   += linesize;
+        g   += linesize;
+        b   += linesize;
+        out += width;
+    }
+}
+
+static void rgb_planes_to_half_base(
+    const uint8_t *r, const uint8_t *g, const uint8_t *b,
+    ptrdiff_t linesize,
+    int width, int height,
+    const float *scale, const float *offset,
+    uint16_t *out, ptrdiff_t plane_size
+) {
+    for (int j = 0; j < height; j++) {
+        half_row(r, g, b, width, scale, offset, out, out + plane_size, out + 2 * plane_size);
+        r   += linesize;
+        g   += linesize;
+        b   += linesize;
+        out += width;
+    }
+}
+
+#if UT_MULTIVERSION
+// The compiler doesn't vectorize half conversions, F16C rounds the same
+// way as float_to_half and gets them in one instruction
+static av_target_avx2_f16c av_always_inline void half_channel_f16c(
+    const uint8_t *c, const uint8_t *g, __m256 scale, __m256 offset, uint16_t *dst, int diff
+) {
+    __m128i x = _mm_loadl_epi64((const __m128i *)c);
+    __m256 f;
+
+    if (diff)
+        x = _mm_sub_epi8(_mm_add_epi8(x, _mm_loadl_epi64((const __m128i *)g)), _mm_set1_epi8((char)0x80));
+    f = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(x));
+    f = _mm256_add_ps(_mm256_mul_ps(f, scale), offset);
+    _mm_storeu_si128((__m128i *)dst, _mm256_cvtps_ph(f, _MM_FROUND_TO_NEAREST_INT));
+}
+
+static av_target_avx2_f16c void rgb_planes_to_half_f16c(
+    const uint8_t *r, const uint8_t *g, const uint8_t *b,
+    ptrdiff_t linesize,
+    int width, int height,
+    const float *scale, const float *offset,
+    uint16_t *out, ptrdiff_t plane_size
+) {
+    const __m256 sr = _mm256_set1_ps(scale[0]), sg = _mm256_set1_ps(scale[1]);
+    const __m256 sb = _mm256_set1_ps(scale[2]), offr = _mm256_set1_ps(offset[0]);
+    const __m256 offg = _mm256_set1_ps(offset[1]), offb = _mm256_set1_ps(offset[2]);
+
+    for (int j = 0; j < height; j++) {
+        int i = 0;
+
+        for (; i + 8 <= width; i += 8) {
+            half_channel_f16c(r + i, g + i, sr, offr, out + i, 1);
+            half_channel_f16c(g + i, g + i, sg, offg, out + plane_size + i, 0);
+            half_channel_f16c(b + i, g + i, sb, offb, out + 2 * plane_size + i, 1);
+        }
+        half_row(
+            r + i, g + i, b + i, width - i, scale, offset,
+            out + i, out + plane_size + i, out + 2 * plane_size + i
+        );
+        r   += linesize;
+        g   += linesize;
+        b   += linesize;
+        out += width;
+    }
+}
+
+typedef void (rgb_planes_to_half_fn)(
+    const uint8_t *, const uint8_t *, const uint8_t *, ptrdiff_t, int, int,
+    const float *, const float *, uint16_t *, ptrdiff_t
+);
+
+static av_resolver rgb_planes_to_half_fn * resolve_rgb_planes_to_half(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("f16c")
+        ? rgb_planes_to_half_f16c : rgb_planes_to_half_base;
+}
+
+void rgb_planes_to_half(
+    const uint8_t *r, const uint8_t *g, const uint8_t *b,
+    ptrdiff_t linesize,
+    int width, int height,
+    const float *scale, const float *offset,
+    uint16_t *out, ptrdiff_t plane_size
+) __attribute__((ifunc("resolve_rgb_planes_to_half")));
+
+#else
+
+void rgb_planes_to_half(
+    const uint8_t *r, const uint8_t *g, const uint8_t *b,
+    ptrdiff_t linesize,
+    int width, int height,
+    const float *scale, const float *offset,
+    uint16_t *out, ptrdiff_t plane_size
+) {
+    rgb_planes_to_half_base(r, g, b, linesize, width, height, scale, offset, out, plane_size);
+}
+
+#endif
+
+// xxHash3's long input loop: 64-byte stripes into 8 lanes, each word
+// keyed, multiplied by halves and added to the lane, the word itself
+// going to the neighbouring lane. The lane loop vectorizes.
+#define HASH_LANES 8
+#define HASH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define HASH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define HASH_PRIME64_3 0x165667B19E3779F9ULL
+
+static const uint64_t hash_keys[HASH_LANES] = {
+    0xBE4BA423396CFEB8ULL, 0x1CAD21F72C81017CULL, 0xDB979083E96DD4DEULL, 0x1F67B3B7A4A44072ULL,
+    0x78E5C0CC4EE679CBULL, 0x2172FFCC7DD05A82ULL, 0x8E2443F7744608B8ULL, 0x4C263A81E69035E0ULL,
+};
+
+static av_always_inline void hash_stripe(uint64_t *acc, const uint8_t *p, const uint64_t *keys) {
+    uint64_t k;
+
+    for (int l = 0; l < HASH_LANES; l++) {
+        k = READ_U64(p + 8 * l) ^ keys[l];
+        acc[l] += READ_U64(p + 8 * (l ^ 1)) + (uint64_t)(uint32_t)k * (uint32_t)(k >> 32);
+    }
+}
+
+static av_always_inline uint64_t hash_avalanche(uint64_t h) {
+    h ^= h >> 37;
+    h *= HASH_PRIME64_3;
+    return h ^ h >> 32;
+}
+
+av_target_clones uint64_t hash_bytes(const uint8_t *data, size_t len, uint64_t seed) {
+    uint64_t acc[HASH_LANES], keys[HASH_LANES], h;
+    uint8_t last[8 * HASH_LANES] = { 0 };
+    size_t n = len;
+
+    for (int l = 0; l < HASH_LANES; l++) {
+        keys[l] = hash_keys[l] + seed;
+        acc[l]  = hash_keys[l ^ 7];
+    }
+    for (; n >= sizeof(last); n -= sizeof(last), data += sizeof(last))
+        hash_stripe(acc, data, keys);
+    // The rest zero filled, the length tells the padding apart
+    for (size_t i = 0; i < n; i++)
+        last[i] = data[i];
+    hash_stripe(acc, last, keys);
+
+    h = len * HASH_PRIME64_1 ^ seed;
+    for (int l = 0; l < HASH_LANES; l++)
+        h = (h ^ hash_avalanche(acc[l] ^ keys[l ^ 1])) * HASH_PRIME64_2;
+    return hash_avalanche(h);
+}
+
+av_target_clones void bswap_buf(uint32_t *dst, const uint32_t *src, int w) {
+    for (int i = 0; i < w; i++)
+        dst[i] = av_bswap32(src[i]);
+}
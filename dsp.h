@@ -0,0 +1,136 @@
+#ifndef __UT_DSP_H__
+#define __UT_DSP_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/**
+ * Left prediction: dst[i] = acc + src[0] + ... + src[i].
+ * dst and src may be the same buffer.
+ * @returns the new accumulator, only the lower 8 bits are meaningful
+ */
+int add_left_pred(uint8_t *dst, const uint8_t *src, ptrdiff_t w, int acc);
+
+/**
+ * Gradient prediction: dst[i] = diff[i] + dst[i-1] + top[i] - top[i-1],
+ * the first pixel is predicted from the top only.
+ */
+void add_gradient_pred(
+    uint8_t *dst, const uint8_t *top, const uint8_t *diff, ptrdiff_t w
+);
+
+/**
+ * Median prediction: dst[i] = diff[i] + median(L, T, L + T - TL).
+ * @param left     in/out, the pixel to the left of dst[0]
+ * @param left_top in/out, the pixel to the left of top[0]
+ */
+void add_median_pred(
+    uint8_t *dst, const uint8_t *top, const uint8_t *diff, ptrdiff_t w,
+    int *left, int *left_top
+);
+
+/**
+ * The inverse of add_left_pred: diff[i] = src[i] - src[i-1], with left
+ * in place of src[-1].
+ * @returns src[w-1], the left of the next row for left prediction
+ */
+int sub_left_pred(uint8_t *diff, const uint8_t *src, ptrdiff_t w, int left);
+
+/**
+ * The inverse of add_gradient_pred.
+ */
+void sub_gradient_pred(
+    uint8_t *diff, const uint8_t *top, const uint8_t *src, ptrdiff_t w
+);
+
+/**
+ * The inverse of add_median_pred, with the same in/out state.
+ */
+void sub_median_pred(
+    uint8_t *diff, const uint8_t *top, const uint8_t *src, ptrdiff_t w,
+    int *left, int *left_top
+);
+
+/**
+ * Pack the G, B-G and R-G planes into RGBA pixels, with alpha from a,
+ * opaque if it's NULL. The output rows are linesize pixels apart.
+ */
+void restore_rgb_planes(
+    const uint8_t *r, const uint8_t *g, const uint8_t *b, const uint8_t *a,
+    ptrdiff_t linesize,
+    int width, int height,
+    uint32_t *out
+);
+
+/**
+ * restore_rgb_planes at a reduced size: one row out of 1 << shift, with
+ * the pixels of each 1 << shift columns averaged, the last ones as far as
+ * the width goes. shift is 1 to 3, height counts the output rows.
+ */
+void restore_rgb_scaled(
+    const uint8_t *r, const uint8_t *g, const uint8_t *b,
+    ptrdiff_t linesize,
+    int width, int height, int shift,
+    uint32_t *out, ptrdiff_t out_stride
+);
+
+/**
+ * The same reduction for a plane of YUV output.
+ */
+void downscale_plane(
+    const uint8_t *src, ptrdiff_t linesize,
+    int width, int height, int shift,
+    uint8_t *dst, ptrdiff_t dst_stride
+);
+
+/**
+ * Convert the G, B-G and R-G planes to limited range YUV 4:2:0, the
+ * chroma of each 2x2 block from its average. Without v the chroma is
+ * interleaved into u as NV12. An odd last row or column is doubled.
+ * @param matrix UT_MATRIX_*
+ */
+void rgb_planes_to_yuv420(
+    const uint8_t *r, const uint8_t *g, const uint8_t *b,
+    ptrdiff_t linesize,
+    int width, int height, int matrix,
+    uint8_t *y, ptrdiff_t y_stride,
+    uint8_t *u, uint8_t *v, ptrdiff_t c_stride
+);
+
+/**
+ * Restore the G, B-G and R-G planes to R, G and B planes of width * height
+ * values each, value * scale + offset per channel, plane_size apart.
+ */
+void rgb_planes_to_float(
+    const uint8_t *r, const uint8_t *g, const uint8_t *b,
+    ptrdiff_t linesize,
+    int width, int height,
+    const float *scale, const float *offset,
+    float *out, ptrdiff_t plane_size
+);
+
+/**
+ * The same as IEEE half floats.
+ */
+void rgb_planes_to_half(
+    const uint8_t *r, const uint8_t *g, const uint8_t *b,
+    ptrdiff_t linesize,
+    int width, int height,
+    const float *scale, const float *offset,
+    uint16_t *out, ptrdiff_t plane_size
+);
+
+/**
+ * 64-bit hash of len bytes in the spirit of xxHash3, not compatible with
+ * it. Chaining the result as the next seed hashes a sequence of buffers.
+ */
+uint64_t hash_bytes(const uint8_t *data, size_t len, uint64_t seed);
+
+/**
+ * Byte swap w 32-bit words.
+ */
+void bswap_buf(uint32_t *dst, const uint32_t *src, int w);
+
+
+#endif // __UT_DSP_H__
@@ -2,21 +2,78 @@
 #define __UT_MEM_H__
 
 #include "defs.h"
+#include "utils.h"
 #include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #define MEM_ALIGN_SIZE 32
 
-void av_always_inline * av_malloc(size_t size) {
-    return aligned_alloc(MEM_ALIGN_SIZE, size);
+static av_always_inline void * av_malloc(size_t size) {
+    // aligned_alloc wants the size to be a multiple of the alignment
+    return aligned_alloc(MEM_ALIGN_SIZE, (size + MEM_ALIGN_SIZE - 1) & ~(size_t)(MEM_ALIGN_SIZE - 1));
 }
 
 
-void av_always_inline * av_realloc_f(void *ptr, size_t nelem, size_t elsize) {
+static av_always_inline void * av_realloc_f(void *ptr, size_t nelem, size_t elsize) {
     void * ret = realloc(ptr, nelem * elsize);
     if (!ret)
         free(ptr);
     return ret;
 }
 
+
+static inline int fast_padded_malloc(
+    void *ptr, uint32_t *size, size_t min_size, int zero_realloc
+) {
+    uint8_t *buf;
+    size_t alloc_size = min_size + AV_INPUT_BUFFER_PADDING_SIZE;
+
+    memcpy(&buf, ptr, sizeof(buf));
+    if (alloc_size > *size) {
+        // The size is kept in 32 bits, the headroom has to fit as well
+        if (alloc_size > UINT32_MAX) {
+            free(buf);
+            buf   = NULL;
+            *size = 0;
+            memcpy(ptr, &buf, sizeof(buf));
+            return AVERROR(ENOMEM);
+        }
+        alloc_size = MIN(alloc_size + alloc_size / 16 + 32, UINT32_MAX);
+
+        free(buf);
+        buf   = av_malloc(alloc_size);
+        *size = buf ? alloc_size : 0;
+        memcpy(ptr, &buf, sizeof(buf));
+        if (!buf)
+            return AVERROR(ENOMEM);
+        if (zero_realloc)
+            memset(buf, 0, alloc_size);
+    }
+    memset(buf + min_size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+
+    return 0;
+}
+
+/**
+ * Make sure *ptr holds at least min_size bytes followed by
+ * AV_INPUT_BUFFER_PADDING_SIZE zeroed bytes. The buffer is only replaced
+ * when it's too small, with some headroom so slowly growing sizes don't
+ * reallocate every time. The old contents are not kept.
+ *
+ * @param size the allocated size of *ptr, padding included, 0 if none
+ * @returns 0 on success, AVERROR(ENOMEM) with *ptr freed otherwise
+ */
+static av_always_inline int av_fast_padded_malloc(void *ptr, uint32_t *size, size_t min_size) {
+    return fast_padded_malloc(ptr, size, min_size, 0);
+}
+
+/**
+ * Same as av_fast_padded_malloc, but a new buffer is zeroed as a whole.
+ */
+static av_always_inline int av_fast_padded_mallocz(void *ptr, uint32_t *size, size_t min_size) {
+    return fast_padded_malloc(ptr, size, min_size, 1);
+}
+
 #endif
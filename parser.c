@@ -0,0 +1,176 @@
+#include "parser.h"
+#include "decoder.h"
+#include "defs.h"
+#include "demuxer.h"
+#include "mem.h"
+#include "utils.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+enum {
+    PARSER_KEY,             // start key
+    PARSER_HEADER_PREFIX,   // header size and end key
+    PARSER_HEADER_DATA,
+    PARSER_PACKET_PREFIX,   // packet header size and end key
+    PARSER_PACKET_INFO,     // packet header, starting with the payload size
+    PARSER_PAYLOAD,
+    PARSER_SKIP,            // payload of a packet before any header
+};
+
+// The frame size and slice count in the header data
+#define HEADER_W_OFFSET 0
+#define HEADER_H_OFFSET 2
+#define HEADER_SLICES_OFFSET 10
+
+
+static void parser_expect(PacketParser * p, int state, uint32_t need) {
+    p->state = state;
+    p->need  = need;
+    p->fill  = 0;
+}
+
+void parser_init(PacketParser * p) {
+    memset(p, 0, sizeof(*p));
+    parser_expect(p, PARSER_KEY, sizeof(uint32_t));
+}
+
+int parser_parse(
+    PacketParser * p, const uint8_t * data, size_t size, size_t * consumed, ParserUnit * u
+) {
+    size_t pos = 0, n;
+    int ret = 0;
+
+    while (!ret && (pos < size || p->fill == p->need)) {
+        if (p->state == PARSER_SKIP) {
+            n = MIN(size - pos, (size_t)(p->need - p->fill));
+            p->fill += n;
+            pos += n;
+            if (p->fill == p->need)
+                parser_expect(p, PARSER_KEY, sizeof(uint32_t));
+            continue;
+        }
+        if (p->state == PARSER_PAYLOAD) {
+            // In place when the chunk has it whole, padding included
+            if (!p->fill && size - pos >= (size_t)p->need + AV_INPUT_BUFFER_PADDING_SIZE) {
+                u->data = data + pos;
+                pos += p->need;
+            } else {
+                if (!p->fill && av_fast_padded_malloc(&p->buf, &p->buf_size, p->need) < 0) {
+                    ret = AVERROR(ENOMEM);
+                    break;
+                }
+                n = MIN(size - pos, (size_t)(p->need - p->fill));
+                memcpy(p->buf + p->fill, data + pos, n);
+                p->fill += n;
+                pos += n;
+                if (p->fill < p->need)
+                    break;
+                u->data = p->buf;
+            }
+            u->type = PARSER_UNIT_PACKET;
+            u->size = p->need;
+            p->packets++;
+            parser_expect(p, PARSER_KEY, sizeof(uint32_t));
+            ret = 1;
+            break;
+        }
+
+        n = MIN(size - pos, (size_t)(p->need - p->fill));
+        memcpy(p->small + p->fill, data + pos, n);
+        p->fill += n;
+        pos += n;
+        if (p->fill < p->need)
+            break;
+
+        // The same steps as demuxer_read_frame, which reads part by part
+        switch (p->state) {
+            case PARSER_KEY:
+                if (READ_U32(p->small) == HEADER_START_KEY)
+                    parser_expect(p, PARSER_HEADER_PREFIX, sizeof(uint8_t) + sizeof(uint16_t));
+                else if (READ_U32(p->small) == PACKET_START_KEY)
+                    parser_expect(p, PARSER_PACKET_PREFIX, sizeof(uint8_t) + sizeof(uint16_t));
+                else
+                    parser_expect(p, PARSER_KEY, sizeof(uint32_t));
+                break;
+            case PARSER_HEADER_PREFIX:
+                if (READ_U16(p->small + 1) != HEADER_END_KEY)
+                    parser_expect(p, PARSER_KEY, sizeof(uint32_t));
+                else
+                    parser_expect(p, PARSER_HEADER_DATA, p->small[0]);
+                break;
+            case PARSER_HEADER_DATA:
+                if (p->need >= HEADER_SLICES_OFFSET + sizeof(uint32_t)) {
+                    p->max_packet_size = video_packet_bound(
+                        READ_U16(p->small + HEADER_W_OFFSET),
+                        READ_U16(p->small + HEADER_H_OFFSET),
+                        READ_U32(p->small + HEADER_SLICES_OFFSET),
+                        UT_MAX_PLANES
+                    );
+                }
+                u->type = PARSER_UNIT_HEADER;
+                u->data = p->small;
+                u->size = p->need;
+                p->headers++;
+                parser_expect(p, PARSER_KEY, sizeof(uint32_t));
+                ret = 1;
+                break;
+            case PARSER_PACKET_PREFIX:
+                // Too short a header to hold the payload size isn't a packet
+                if (READ_U16(p->small + 1) != PACKET_END_KEY || p->small[0] < sizeof(uint32_t))
+                    parser_expect(p, PARSER_KEY, sizeof(uint32_t));
+                else
+                    parser_expect(p, PARSER_PACKET_INFO, p->small[0]);
+                break;
+            case PARSER_PACKET_INFO:
+                // Nothing can decode it, pass over it without buffering
+                if (!p->max_packet_size) {
+                    parser_expect(p, PARSER_SKIP, READ_U32(p->small));
+                    p->packets++;
+                    p->skipped++;
+                // A corrupt size, look for the next key right after it
+                } else if (READ_U32(p->small) > p->max_packet_size) {
+                    log_info("Packet size %u too large for the frame\n", READ_U32(p->small));
+                    parser_expect(p, PARSER_KEY, sizeof(uint32_t));
+                } else {
+                    parser_expect(p, PARSER_PAYLOAD, READ_U32(p->small));
+                }
+                break;
+        }
+    }
+
+    *consumed = pos;
+    return ret;
+}
+
+int parser_decode(VideoContext * ctx, const ParserUnit * u) {
+    uint8_t * own = ctx->packet_data;
+    uint32_t own_size = ctx->packet_size;
+    int got_frame = 0, ret;
+
+    if (u->type == PARSER_UNIT_HEADER) {
+        // Only read, the unit is the parser's
+        ret = video_from_data(ctx, (uint8_t *)u->data, u->size);
+        return ret < 0 ? ret : 0;
+    }
+    if (!ctx->planes) {
+        log_info("Packet before a valid header, skipped\n");
+        return 0;
+    }
+
+    // The decoder only reads the packet, no need for a copy
+    ctx->packet_data = (uint8_t *)u->data;
+    ctx->packet_size = u->size;
+    ret = decode_frame(ctx, &got_frame);
+    ctx->packet_data = own;
+    ctx->packet_size = own_size;
+
+    return ret < 0 ? ret : got_frame;
+}
+
+void parser_free(PacketParser * p) {
+    free(p->buf);
+    p->buf = NULL;
+    p->buf_size = 0;
+}
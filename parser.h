@@ -0,0 +1,79 @@
+#ifndef __UT_PARSER_H__
+#define __UT_PARSER_H__
+
+#include "video.h"
+#include <stddef.h>
+#include <stdint.h>
+
+enum {
+    PARSER_UNIT_HEADER = 1, // the bytes after HEADER_END_KEY, for video_from_data
+    PARSER_UNIT_PACKET,     // the payload of a packet, for decode_frame
+};
+
+
+/**
+ * Push counterpart of the demuxer, for input arriving in chunks of any
+ * size (pipes, sockets, receive buffers).
+ *
+ * The parser keeps its place in the key/header/payload sequence across
+ * chunks and splits the stream as the demuxer does, only it checks the
+ * packet sizes against full size planes whatever the format. A packet that
+ * lies inside one chunk, with AV_INPUT_BUFFER_PADDING_SIZE bytes of the
+ * chunk after it, points into that chunk. Others are put together in the
+ * parser's own padded buffer.
+ */
+typedef struct PacketParser {
+    int state;
+    // The fixed size parts, start key, sizes and end keys, header data
+    uint8_t small[256];
+    // Bytes wanted for the current part, and gathered so far
+    uint32_t need;
+    uint32_t fill;
+
+    // Payloads split across chunks
+    uint8_t * buf;
+    uint32_t buf_size;
+
+    // Largest payload the last header allows, 0 before the first one.
+    // Larger sizes are corrupt, the parser looks for the next key instead.
+    uint64_t max_packet_size;
+
+    // Units seen so far, for statistics. Packets before the first header
+    // are passed over without being returned, and counted as skipped.
+    uint32_t headers;
+    uint32_t packets;
+    uint32_t skipped;
+} PacketParser;
+
+typedef struct ParserUnit {
+    int type;               // PARSER_UNIT_*
+    // Valid until the next call. Packets are followed by
+    // AV_INPUT_BUFFER_PADDING_SIZE readable bytes
+    const uint8_t * data;
+    uint32_t size;
+} ParserUnit;
+
+
+void parser_init(PacketParser * p);
+
+/**
+ * Parse data up to the end of the next unit.
+ * @param consumed set to the bytes of data used, all of them unless a
+ *                 unit was returned
+ * @returns 1 with u filled in, 0 if data ran out first, or AVERROR(ENOMEM)
+ */
+int parser_parse(
+    PacketParser * p, const uint8_t * data, size_t size, size_t * consumed, ParserUnit * u
+);
+
+/**
+ * Apply a unit to ctx: a header sets it up, a packet is decoded in place.
+ * Packets before the first valid header are skipped.
+ * @returns 1 with a frame decoded, 0 otherwise, or a negative AVERROR
+ */
+int parser_decode(VideoContext * ctx, const ParserUnit * u);
+
+void parser_free(PacketParser * p);
+
+
+#endif // __UT_PARSER_H__
@@ -0,0 +1,390 @@
+#include "reslice.h"
+#include "defs.h"
+#include "demuxer.h"
+#include "dsp.h"
+#include "mem.h"
+#include "utils.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The longest code the lengths table can hold
+#define RESLICE_MAX_CODE_LEN 32
+// Start key, header size and end key in front of the header data
+#define HEADER_PREFIX_SIZE (4 + 1 + 2)
+// Start key, packet header size, end key and the packet header
+#define PACKET_PREFIX_SIZE (4 + 1 + 2 + 4)
+// Where the slice count is in the header data
+#define HEADER_SLICES_OFFSET 10
+
+
+// Codes of a plane, for symbols with a length of 1 to 32
+typedef struct PlaneCodes {
+    uint8_t lens[UT_HUFF_ELEMS];
+    uint32_t codes[UT_HUFF_ELEMS];
+    // Symbol filling the whole plane, or -1
+    int fsym;
+    // Upper bound of the coded slices, in bytes
+    size_t size;
+} PlaneCodes;
+
+
+/**
+ * The residuals of one row of a slice, the inverse of restore_row in
+ * the decoder with the same state carried from row to row.
+ * @param row row index inside of the slice
+ */
+static av_always_inline void predict_row(
+    int pred, int row,
+    const uint8_t *src, ptrdiff_t stride,
+    uint8_t *buf, int width,
+    int *prev, int *A, int *B
+) {
+    switch (pred) {
+    case UT_PRED_NONE:
+        memcpy(buf, src, width);
+        break;
+    case UT_PRED_LEFT:
+        *prev = sub_left_pred(buf, src, width, *prev);
+        break;
+    case UT_PRED_GRADIENT:
+        if (!row)
+            sub_left_pred(buf, src, width, 0x80);
+        else
+            sub_gradient_pred(buf, src - stride, src, width);
+        break;
+    case UT_PRED_MEDIAN:
+        if (!row) {
+            sub_left_pred(buf, src, width, 0x80);
+        } else if (row == 1) {
+            buf[0] = src[0] - src[-stride];
+            *A = src[0];
+            *B = src[-stride];
+            sub_median_pred(buf + 1, src + 1 - stride, src + 1, width - 1, A, B);
+        } else {
+            sub_median_pred(buf, src - stride, src, width, A, B);
+        }
+        break;
+    }
+}
+
+/**
+ * Huffman code lengths of the symbols with a count, 0 for the others.
+ * @param n symbols with a count, at least 2
+ * @returns the longest length
+ */
+static int huff_lengths(const uint64_t *counts, int n, uint8_t *lens) {
+    uint64_t weight[2 * UT_HUFF_ELEMS];
+    int parent[2 * UT_HUFF_ELEMS];
+    int sym[UT_HUFF_ELEMS];
+    // Roots of the trees left to merge
+    int roots[UT_HUFF_ELEMS];
+    int nodes = 0, left = n, max_len = 0;
+
+    for (int i = 0; i < UT_HUFF_ELEMS; i++) {
+        lens[i] = 0;
+        if (counts[i]) {
+            weight[nodes] = counts[i];
+            sym[nodes] = i;
+            roots[nodes] = nodes;
+            nodes++;
+        }
+    }
+
+    // At most 256 symbols, picking the two lightest by scanning will do
+    while (left > 1) {
+        int a = 0, b = 1;
+
+        if (weight[roots[b]] < weight[roots[a]])
+            a = 1, b = 0;
+        for (int i = 2; i < left; i++) {
+            if (weight[roots[i]] < weight[roots[a]])
+                b = a, a = i;
+            else if (weight[roots[i]] < weight[roots[b]])
+                b = i;
+        }
+
+        weight[nodes] = weight[roots[a]] + weight[roots[b]];
+        parent[roots[a]] = parent[roots[b]] = nodes;
+        roots[a] = nodes++;
+        roots[b] = roots[--left];
+    }
+
+    for (int i = 0; i < n; i++) {
+        int len = 0;
+
+        for (int j = i; j != nodes - 1; j = parent[j])
+            len++;
+        lens[sym[i]] = len;
+        max_len = MAX(max_len, len);
+    }
+    return max_len;
+}
+
+/**
+ * Build the codes of a plane from the counts of its residuals. The codes
+ * are assigned the way build_huff in the decoder expects them: longer
+ * codes first, and higher symbols first among codes of the same length.
+ */
+static void plane_codes(const uint64_t *counts, PlaneCodes *pc) {
+    uint64_t limited[UT_HUFF_ELEMS];
+    uint8_t order[UT_HUFF_ELEMS];
+    uint32_t code = 0;
+    uint64_t bits = 0;
+    int n = 0, k = 0;
+
+    pc->fsym = -1;
+    for (int i = 0; i < UT_HUFF_ELEMS; i++) {
+        if (counts[i]) {
+            pc->fsym = i;
+            n++;
+        }
+    }
+    if (n <= 1) {
+        // Nothing to code, the slices are filled with the symbol
+        pc->fsym = MAX(pc->fsym, 0);
+        pc->size = 0;
+        return;
+    }
+    pc->fsym = -1;
+
+    // Flatten the counts until no code is too long for the table
+    for (int shift = 0;; shift++) {
+        for (int i = 0; i < UT_HUFF_ELEMS; i++)
+            limited[i] = counts[i] ? counts[i] >> shift | 1 : 0;
+        if (huff_lengths(limited, n, pc->lens) <= RESLICE_MAX_CODE_LEN)
+            break;
+    }
+
+    // By length then symbol, codes are handed out from the end
+    for (int len = 1; len <= RESLICE_MAX_CODE_LEN; len++) {
+        for (int i = 0; i < UT_HUFF_ELEMS; i++) {
+            if (pc->lens[i] == len)
+                order[k++] = i;
+        }
+    }
+    for (int i = n - 1; i >= 0; i--) {
+        const int len = pc->lens[order[i]];
+
+        pc->codes[order[i]] = code >> (32 - len);
+        code += 0x80000000u >> (len - 1);
+        bits += counts[order[i]] * len;
+    }
+    pc->size = (bits + 7) / 8;
+}
+
+/**
+ * Code n residuals as a slice: the bits MSB first in 32-bit words, stored
+ * little endian, the last word padded with zeros.
+ * @returns the end of the slice
+ */
+static uint8_t * write_slice(uint8_t *dst, const uint8_t *src, size_t n, const PlaneCodes *pc) {
+    uint64_t acc = 0;
+    int bits = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        acc = acc << pc->lens[src[i]] | pc->codes[src[i]];
+        bits += pc->lens[src[i]];
+        if (bits >= 32) {
+            bits -= 32;
+            WRITE_U32(dst, (uint32_t)(acc >> bits));
+            dst += 4;
+        }
+    }
+    if (bits) {
+        WRITE_U32(dst, (uint32_t)(acc << (32 - bits)));
+        dst += 4;
+    }
+    return dst;
+}
+
+/**
+ * The residuals of a decoded plane over the output slices, rows plane_w
+ * apart, and their counts. Rows outside of the slices are left alone.
+ */
+static void plane_residuals(Reslicer *r, int plane_no, uint8_t *res, uint64_t *counts) {
+    const VideoContext *ctx = &r->video;
+    const int width = ctx->plane_w[plane_no], height = ctx->plane_h[plane_no];
+    const ptrdiff_t stride = ctx->linesize[plane_no];
+    const uint8_t *src;
+    uint8_t *buf;
+    int sstart, send;
+
+    memset(counts, 0, UT_HUFF_ELEMS * sizeof(*counts));
+    for (uint32_t slice = 0; slice < r->stream_slices; slice++) {
+        int prev = 0x80, A = 0, B = 0;
+
+        video_slice_rows(ctx, plane_no, height, r->stream_slices, slice, &sstart, &send);
+        src = ctx->frame_data[plane_no] + sstart * stride;
+        buf = res + (size_t)sstart * width;
+        for (int j = sstart; j < send; j++) {
+            predict_row(ctx->frame_pred, j - sstart, src, stride, buf, width, &prev, &A, &B);
+            for (int i = 0; i < width; i++)
+                counts[buf[i]]++;
+            src += stride;
+            buf += width;
+        }
+    }
+}
+
+/**
+ * The most slices up to the requested ones the stream can be cut into,
+ * the decoder takes a slice without rows for a damaged one.
+ */
+static uint32_t stream_slices(const Reslicer *r) {
+    const VideoContext *ctx = &r->video;
+    uint32_t slices = r->slices;
+    int sstart, send;
+
+    for (int i = 0; i < ctx->planes; i++) {
+        for (uint32_t slice = 0; slice < slices; slice++) {
+            video_slice_rows(ctx, i, ctx->plane_h[i], slices, slice, &sstart, &send);
+            if (sstart == send && slices > 1) {
+                // Try again with one less, from the first plane
+                slices--;
+                i = -1;
+                break;
+            }
+        }
+    }
+    return slices;
+}
+
+static int reslice_header(Reslicer *r, const ParserUnit *u, const uint8_t **out, uint32_t *out_size) {
+    uint8_t *dst;
+    int ret;
+
+    if (u->size < HEADER_SLICES_OFFSET + 4)
+        return AVERROR_INVALIDDATA;
+    ret = parser_decode(&r->video, u);
+    if (ret < 0)
+        return ret;
+    r->stream_slices = stream_slices(r);
+    ret = av_fast_padded_malloc(&r->buf, &r->buf_size, HEADER_PREFIX_SIZE + u->size);
+    if (ret < 0)
+        return ret;
+
+    dst = r->buf;
+    WRITE_U32(dst, HEADER_START_KEY);
+    dst[4] = u->size;
+    WRITE_U16(dst + 5, HEADER_END_KEY);
+    dst += HEADER_PREFIX_SIZE;
+    memcpy(dst, u->data, u->size);
+    WRITE_U32(dst + HEADER_SLICES_OFFSET, r->stream_slices);
+
+    *out = r->buf;
+    *out_size = HEADER_PREFIX_SIZE + u->size;
+    return 0;
+}
+
+/**
+ * Code the decoded planes as a packet with the output slices.
+ */
+static int encode_frame(Reslicer *r, const uint8_t **out, uint32_t *out_size) {
+    const VideoContext *ctx = &r->video;
+    PlaneCodes pc[UT_MAX_PLANES];
+    uint64_t counts[UT_HUFF_ELEMS];
+    uint8_t *res[UT_MAX_PLANES];
+    size_t size = PACKET_PREFIX_SIZE + 4, res_size = 0;
+    uint8_t *dst, *slice_end, *data;
+    int ret, sstart, send;
+
+    for (int i = 0; i < ctx->planes; i++)
+        res_size += (size_t)ctx->plane_w[i] * ctx->plane_h[i];
+    ret = av_fast_padded_malloc(&r->residuals, &r->residuals_size, res_size);
+    if (ret < 0)
+        return ret;
+
+    res_size = 0;
+    for (int i = 0; i < ctx->planes; i++) {
+        res[i] = r->residuals + res_size;
+        res_size += (size_t)ctx->plane_w[i] * ctx->plane_h[i];
+        plane_residuals(r, i, res[i], counts);
+        plane_codes(counts, &pc[i]);
+        // Each slice rounds up to a whole word
+        size += UT_HUFF_ELEMS + 8 * r->stream_slices + pc[i].size;
+    }
+    if (size > UINT32_MAX - AV_INPUT_BUFFER_PADDING_SIZE)
+        return AVERROR(ENOMEM);
+    ret = av_fast_padded_malloc(&r->buf, &r->buf_size, size);
+    if (ret < 0)
+        return ret;
+
+    dst = r->buf + PACKET_PREFIX_SIZE;
+    for (int i = 0; i < ctx->planes; i++) {
+        const int width = ctx->plane_w[i];
+
+        if (pc[i].fsym >= 0) {
+            // Only the prediction runs, every slice is empty
+            memset(dst, 0xFF, UT_HUFF_ELEMS);
+            dst[pc[i].fsym] = 0;
+            memset(dst + UT_HUFF_ELEMS, 0, 4 * r->stream_slices);
+            dst += UT_HUFF_ELEMS + 4 * r->stream_slices;
+            continue;
+        }
+
+        for (int j = 0; j < UT_HUFF_ELEMS; j++)
+            dst[j] = pc[i].lens[j] ? pc[i].lens[j] : 0xFF;
+        slice_end = dst + UT_HUFF_ELEMS;
+        dst = data = slice_end + 4 * r->stream_slices;
+        for (uint32_t slice = 0; slice < r->stream_slices; slice++) {
+            video_slice_rows(ctx, i, ctx->plane_h[i], r->stream_slices, slice, &sstart, &send);
+            dst = write_slice(
+                dst, res[i] + (size_t)sstart * width,
+                (size_t)(send - sstart) * width, &pc[i]
+            );
+            WRITE_U32(slice_end + 4 * slice, dst - data);
+        }
+    }
+    // The frame info, with the prediction the residuals were made with
+    WRITE_U32(dst, ctx->frame_pred << 8);
+    dst += 4;
+
+    size = dst - r->buf;
+    WRITE_U32(r->buf, PACKET_START_KEY);
+    r->buf[4] = 4;
+    WRITE_U16(r->buf + 5, PACKET_END_KEY);
+    WRITE_U32(r->buf + 7, size - PACKET_PREFIX_SIZE);
+
+    *out = r->buf;
+    *out_size = size;
+    return 0;
+}
+
+static int reslice_packet(Reslicer *r, const ParserUnit *u, const uint8_t **out, uint32_t *out_size) {
+    int ret = parser_decode(&r->video, u);
+
+    if (ret <= 0)
+        return ret;
+    return encode_frame(r, out, out_size);
+}
+
+
+int reslice_init(Reslicer * r, uint32_t slices) {
+    memset(r, 0, sizeof(*r));
+    if (!slices || slices > UT_MAX_SLICES)
+        return AVERROR(EINVAL);
+
+    r->slices = slices;
+    // Only the planes are needed, RGB isn't packed into RGBA
+    r->video.output_format = UT_OUTPUT_NONE;
+    return 0;
+}
+
+int reslice_unit(Reslicer * r, const ParserUnit * u, const uint8_t ** out, uint32_t * out_size) {
+    *out = NULL;
+    *out_size = 0;
+    if (u->type == PARSER_UNIT_HEADER)
+        return reslice_header(r, u, out, out_size);
+    return reslice_packet(r, u, out, out_size);
+}
+
+void reslice_free(Reslicer * r) {
+    video_free(&r->video);
+    free(r->buf);
+    free(r->residuals);
+    r->buf = NULL;
+    r->residuals = NULL;
+    r->buf_size = 0;
+    r->residuals_size = 0;
+}
@@ -0,0 +1,58 @@
+#ifndef __UT_RESLICE_H__
+#define __UT_RESLICE_H__
+
+#include "parser.h"
+#include "video.h"
+#include <stdint.h>
+
+
+/**
+ * Lossless rewrite of a stream to another slice count, so streams
+ * recorded with one slice per plane can be decoded a band at a time
+ * (and in parallel) like the ones recorded with many.
+ *
+ * Each packet is decoded to its planes, the residuals are recomputed
+ * with the frame's own prediction over the new slices, and coded again
+ * with Huffman lengths built from their counts. Headers are kept but for
+ * the slice count. The output units are in the container format, start
+ * keys included, ready to be written one after the other.
+ */
+typedef struct Reslicer {
+    // The source stream, decoded to its planes only
+    VideoContext video;
+    // Of the output stream, as requested and as many of them as the
+    // current header allows, every slice needs rows of its own
+    uint32_t slices;
+    uint32_t stream_slices;
+
+    // The rewritten unit
+    uint8_t * buf;
+    uint32_t buf_size;
+
+    // The residuals of a frame, plane after plane
+    uint8_t * residuals;
+    uint32_t residuals_size;
+} Reslicer;
+
+
+/**
+ * @param slices 1 to UT_MAX_SLICES
+ * @returns 0 or AVERROR(EINVAL)
+ */
+int reslice_init(Reslicer * r, uint32_t slices);
+
+/**
+ * Rewrite a unit from the parser. Streams with too few rows for the
+ * requested slices get as many as they can have.
+ * @param out      set to the bytes of the rewritten unit, valid until
+ *                 the next call
+ * @param out_size 0 for packets before the first valid header, which
+ *                 are dropped
+ * @returns 0 or a negative AVERROR, a packet that doesn't decode fails
+ */
+int reslice_unit(Reslicer * r, const ParserUnit * u, const uint8_t ** out, uint32_t * out_size);
+
+void reslice_free(Reslicer * r);
+
+
+#endif // __UT_RESLICE_H__
@@ -0,0 +1,332 @@
+#define _GNU_SOURCE
+#include "ring.h"
+#include "defs.h"
+#include "mem.h"
+#include "utils.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define RING_MAGIC MKTAG('U', 'T', 'R', 'G')
+#define RING_MAX_SLOTS 64
+
+// The slots start on a page of their own, the planes at cache lines
+#define RING_PAGE_SIZE 4096
+#define RING_HEADER_SIZE RING_PAGE_SIZE
+#define RING_ALIGN(x, a) (((x) + (a) - 1) & ~(size_t)((a) - 1))
+
+enum {
+    RING_OUTPUT_RGBA,
+    RING_OUTPUT_YUV,    // yuv_data, from RGB
+    RING_OUTPUT_PLANES, // frame_data, of YUV streams
+};
+
+
+// At the start of the memfd, shared by both sides
+typedef struct RingHeader {
+    uint32_t magic;
+    uint32_t slots;
+    uint64_t slot_size;
+
+    // Written by one side each, on cache lines of their own
+    _Alignas(64) uint64_t head; // frames published
+    _Alignas(64) uint64_t tail; // frames released
+} RingHeader;
+
+struct FrameRing {
+    RingHeader * hdr;
+    uint8_t * base;
+    size_t map_size;
+    int fd;
+    int producer;
+    // Checked once, the other side could change the shared copies
+    uint32_t slots;
+    size_t slot_size;
+
+    // Producer, where the output of its contexts goes
+    int output;
+    RingFrame layout;
+    uint8_t * slot;
+
+    // The context buffers a slot stands in for
+    uint8_t * own_data[UT_MAX_PLANES];
+    uint8_t * own_yuv[UT_COLOR_PLANES];
+    uint32_t * own_rgba;
+
+    // Consumer, the peeked frame as it was checked and its slot
+    RingFrame frame;
+    const uint8_t * frame_slot;
+};
+
+
+/**
+ * The output planes of ctx as they are laid out in a slot.
+ * @returns the slot bytes they take, 0 if they can't go to a slot
+ */
+static size_t ring_layout(const VideoContext * ctx, RingFrame * f, int * output) {
+    size_t size = RING_ALIGN(sizeof(*f), 64);
+
+    memset(f, 0, sizeof(*f));
+    if (!ctx->planes || ctx->preview_shift)
+        return 0;
+
+    f->w = ctx->w;
+    f->h = ctx->h;
+    f->format = ctx->format;
+    f->output_format = ctx->output_format;
+    if (ctx->yuv_data[0]) {
+        *output = RING_OUTPUT_YUV;
+        for (int i = 0; i < UT_COLOR_PLANES && ctx->yuv_data[i]; i++) {
+            f->linesize[i] = ctx->yuv_linesize[i];
+            f->height[i] = i ? (ctx->h + 1) >> 1 : ctx->h;
+            f->planes++;
+        }
+    } else if (ctx->result_frame_data) {
+        *output = RING_OUTPUT_RGBA;
+        f->linesize[0] = ctx->linesize[0] * 4;
+        f->height[0] = ctx->h;
+        f->planes = 1;
+    } else if (!video_is_rgb(ctx) && !(ctx->flags & VIDEO_FLAG_CONCEAL)) {
+        *output = RING_OUTPUT_PLANES;
+        for (int i = 0; i < ctx->planes; i++) {
+            f->linesize[i] = ctx->linesize[i];
+            f->height[i] = ctx->plane_h[i];
+        }
+        f->planes = ctx->planes;
+    } else {
+        return 0;
+    }
+
+    for (int i = 0; i < f->planes; i++) {
+        f->offset[i] = size;
+        size += RING_ALIGN((size_t)f->linesize[i] * f->height[i], 64);
+    }
+    return size;
+}
+
+// Whether the output of ctx still points at the acquired slot
+static int ring_redirected(const FrameRing * r, const VideoContext * ctx) {
+    const uint8_t * first = r->slot + r->layout.offset[0];
+
+    switch (r->output) {
+        case RING_OUTPUT_RGBA:
+            return (const uint8_t *)ctx->result_frame_data == first;
+        case RING_OUTPUT_YUV:
+            return ctx->yuv_data[0] == first;
+        default:
+            return ctx->frame_data[0] == first;
+    }
+}
+
+static void ring_restore(FrameRing * r, VideoContext * ctx) {
+    // A header in between gave ctx new buffers, the old ones are gone
+    if (ring_redirected(r, ctx)) {
+        memcpy(ctx->frame_data, r->own_data, sizeof(r->own_data));
+        memcpy(ctx->yuv_data, r->own_yuv, sizeof(r->own_yuv));
+        ctx->result_frame_data = r->own_rgba;
+    }
+    r->slot = NULL;
+}
+
+static FrameRing * ring_map(int fd, size_t size, int producer) {
+    FrameRing * r = calloc(1, sizeof(*r));
+    void * p;
+
+    if (!r)
+        return NULL;
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        free(r);
+        return NULL;
+    }
+    r->hdr = p;
+    r->base = (uint8_t *)p + RING_HEADER_SIZE;
+    r->map_size = size;
+    r->fd = fd;
+    r->producer = producer;
+    return r;
+}
+
+
+FrameRing * ring_create(const VideoContext * ctx, int slots) {
+    RingFrame layout;
+    size_t slot_size, size;
+    FrameRing * r;
+    int output = 0;
+    int fd;
+
+    slot_size = RING_ALIGN(ring_layout(ctx, &layout, &output), RING_PAGE_SIZE);
+    if (!slot_size)
+        return NULL;
+    if (slots <= 0)
+        slots = RING_DEFAULT_SLOTS;
+    slots = MIN(slots, RING_MAX_SLOTS);
+    size = RING_HEADER_SIZE + slot_size * slots;
+
+    // Sealed to its size, the consumer can map it without fearing SIGBUS
+    fd = memfd_create("utmini-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0)
+        return NULL;
+    if (ftruncate(fd, size) < 0 ||
+        fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0 ||
+        !(r = ring_map(fd, size, 1))) {
+        close(fd);
+        return NULL;
+    }
+
+    r->output = output;
+    r->layout = layout;
+    r->slots = slots;
+    r->slot_size = slot_size;
+    r->hdr->slots = slots;
+    r->hdr->slot_size = slot_size;
+    __atomic_store_n(&r->hdr->magic, RING_MAGIC, __ATOMIC_RELEASE);
+    return r;
+}
+
+FrameRing * ring_attach(int fd) {
+    const RingHeader * hdr;
+    FrameRing * r;
+    struct stat st;
+    int seals;
+
+    seals = fcntl(fd, F_GET_SEALS);
+    if (fstat(fd, &st) < 0 || seals < 0 || !(seals & F_SEAL_SHRINK) ||
+        (size_t)st.st_size < RING_HEADER_SIZE)
+        return NULL;
+    r = ring_map(fd, st.st_size, 0);
+    if (!r)
+        return NULL;
+
+    hdr = r->hdr;
+    if (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != RING_MAGIC ||
+        !hdr->slots || hdr->slots > RING_MAX_SLOTS ||
+        hdr->slot_size % RING_PAGE_SIZE || hdr->slot_size > (size_t)st.st_size ||
+        hdr->slot_size * hdr->slots > (size_t)st.st_size - RING_HEADER_SIZE) {
+        ring_close(r);
+        return NULL;
+    }
+    r->slots = hdr->slots;
+    r->slot_size = hdr->slot_size;
+    return r;
+}
+
+int ring_fd(const FrameRing * r) {
+    return r->fd;
+}
+
+int ring_acquire(FrameRing * r, VideoContext * ctx) {
+    RingHeader * hdr = r->hdr;
+    const uint64_t head = hdr->head;
+    RingFrame layout;
+    int output = 0;
+
+    if (!r->producer || r->slot)
+        return AVERROR(EINVAL);
+    if (!ring_layout(ctx, &layout, &output) || output != r->output ||
+        memcmp(&layout, &r->layout, sizeof(layout)))
+        return AVERROR(EINVAL);
+    if (head - __atomic_load_n(&hdr->tail, __ATOMIC_ACQUIRE) >= r->slots)
+        return AVERROR(EAGAIN);
+
+    r->slot = r->base + head % r->slots * r->slot_size;
+    memcpy(r->own_data, ctx->frame_data, sizeof(r->own_data));
+    memcpy(r->own_yuv, ctx->yuv_data, sizeof(r->own_yuv));
+    r->own_rgba = ctx->result_frame_data;
+
+    for (int i = 0; i < layout.planes; i++) {
+        uint8_t * plane = r->slot + layout.offset[i];
+
+        if (r->output == RING_OUTPUT_RGBA)
+            ctx->result_frame_data = (uint32_t *)plane;
+        else if (r->output == RING_OUTPUT_YUV)
+            ctx->yuv_data[i] = plane;
+        else
+            ctx->frame_data[i] = plane;
+    }
+    return 0;
+}
+
+int ring_publish(FrameRing * r, VideoContext * ctx) {
+    RingHeader * hdr = r->hdr;
+    RingFrame * f = (RingFrame *)r->slot;
+    int decoded;
+
+    if (!f)
+        return AVERROR(EINVAL);
+    decoded = ring_redirected(r, ctx);
+    ring_restore(r, ctx);
+    if (!decoded)
+        return AVERROR(EINVAL);
+
+    *f = r->layout;
+    f->number = hdr->head;
+    f->concealed_slices = ctx->concealed_slices;
+    // The frame is complete before the consumer can see it
+    __atomic_store_n(&hdr->head, hdr->head + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void ring_cancel(FrameRing * r, VideoContext * ctx) {
+    if (r->slot)
+        ring_restore(r, ctx);
+}
+
+// Whether the planes of f lie inside a slot
+static int ring_frame_valid(const FrameRing * r, const RingFrame * f) {
+    if (f->planes > UT_COLOR_PLANES)
+        return 0;
+    for (int i = 0; i < f->planes; i++) {
+        if (f->offset[i] < sizeof(*f) ||
+            f->offset[i] + (uint64_t)f->linesize[i] * f->height[i] > r->slot_size)
+            return 0;
+    }
+    return 1;
+}
+
+const RingFrame * ring_peek(FrameRing * r) {
+    const RingHeader * hdr = r->hdr;
+    uint64_t tail;
+
+    if (r->producer)
+        return NULL;
+    for (;;) {
+        tail = hdr->tail;
+        if (tail == __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE))
+            return NULL;
+
+        // Checked as copied, the producer can't move the planes afterwards
+        r->frame_slot = r->base + tail % r->slots * r->slot_size;
+        memcpy(&r->frame, r->frame_slot, sizeof(r->frame));
+        if (ring_frame_valid(r, &r->frame))
+            return &r->frame;
+        log_info("Ring frame %lu doesn't fit its slot, dropped\n", (unsigned long)tail);
+        ring_release(r);
+    }
+}
+
+const uint8_t * ring_frame_plane(const FrameRing * r, int i) {
+    return r->frame_slot + r->frame.offset[i];
+}
+
+void ring_release(FrameRing * r) {
+    RingHeader * hdr = r->hdr;
+    const uint64_t tail = hdr->tail;
+
+    // Done reading the slot before the producer can reuse it
+    if (!r->producer && tail != __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE))
+        __atomic_store_n(&hdr->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+void ring_close(FrameRing * r) {
+    if (!r)
+        return;
+    munmap(r->hdr, r->map_size);
+    if (r->producer)
+        close(r->fd);
+    free(r);
+}
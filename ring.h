@@ -0,0 +1,112 @@
+#ifndef __UT_RING_H__
+#define __UT_RING_H__
+
+#include "video.h"
+#include <stdint.h>
+
+#define RING_DEFAULT_SLOTS 4
+
+
+/**
+ * Frame ring in shared memory, for handing decoded frames to another
+ * process without copying them.
+ *
+ * A sealed memfd holds the ring state and a number of frame slots. The
+ * producer points the output of its context at the next free slot, the
+ * frame is restored straight into it, then published by moving the head
+ * index. A consumer maps the same fd, reads the oldest published frame in
+ * place and releases it by moving the tail index. Both indices only grow
+ * and each side writes one of them, so neither locks nor makes syscalls
+ * after setup. Waiting on a full or empty ring is up to the caller.
+ *
+ * The output has to be one the slots can take: RGBA rows, YUV output from
+ * RGB, or the planes of YUV streams without concealment, which needs the
+ * previous frame in the decoder's own planes. A new frame size or format
+ * needs a new ring.
+ */
+typedef struct FrameRing FrameRing;
+
+/**
+ * At the start of each slot, written by the producer as it publishes.
+ */
+typedef struct RingFrame {
+    uint64_t number;            // frames published before this one
+    uint16_t w;
+    uint16_t h;
+    uint8_t format;             // UT_FMT_*
+    uint8_t output_format;      // UT_OUTPUT_* of RGB streams
+    uint8_t planes;             // 1 for RGBA
+    uint32_t concealed_slices;
+    // Per output plane, from the start of the slot
+    uint32_t offset[UT_COLOR_PLANES];
+    uint32_t linesize[UT_COLOR_PLANES];
+    uint16_t height[UT_COLOR_PLANES];
+} RingFrame;
+
+
+/**
+ * Producer side, with the slots sized for the output of ctx.
+ * @param ctx   set up by a header, with the output settings it decodes with
+ * @param slots RING_DEFAULT_SLOTS if 0
+ * @returns NULL on failure or if the output can't go to a ring
+ */
+FrameRing * ring_create(const VideoContext * ctx, int slots);
+
+/**
+ * Consumer side, on a ring fd received from the producer.
+ * @param fd stays owned by the caller
+ * @returns NULL on failure or if fd isn't a ring
+ */
+FrameRing * ring_attach(int fd);
+
+/**
+ * The memfd to pass to the consumer, owned by the producer's ring.
+ */
+int ring_fd(const FrameRing * r);
+
+/**
+ * Point the output of ctx at the next free slot, before decoding a frame.
+ * @returns 0, AVERROR(EAGAIN) if the consumer holds all the slots,
+ *          AVERROR(EINVAL) if ctx doesn't fit the ring (anymore)
+ */
+int ring_acquire(FrameRing * r, VideoContext * ctx);
+
+/**
+ * Publish the frame decoded into the acquired slot, and give ctx its own
+ * output back.
+ * @returns 0, or AVERROR(EINVAL) if a header replaced the buffers of ctx
+ *          in between, the frame then isn't in the slot
+ */
+int ring_publish(FrameRing * r, VideoContext * ctx);
+
+/**
+ * Give ctx its own output back without publishing, when no frame was
+ * decoded.
+ */
+void ring_cancel(FrameRing * r, VideoContext * ctx);
+
+/**
+ * The oldest published frame, without waiting. The consumer gets its own
+ * copy of the frame header, checked to have every plane, offset + linesize
+ * * height bytes, inside the slot. Frames failing the check are dropped.
+ * The ring geometry is taken once as the ring is attached, so a producer
+ * writing to the shared state can't make the consumer read outside the
+ * mapping, as long as rows are read up to their linesize.
+ * @returns NULL if there is none, the copy is valid until the next call
+ */
+const RingFrame * ring_peek(FrameRing * r);
+
+/**
+ * Plane i of the peeked frame, rows linesize[i] apart.
+ */
+const uint8_t * ring_frame_plane(const FrameRing * r, int i);
+
+/**
+ * Hand the slot of the peeked frame back to the producer.
+ */
+void ring_release(FrameRing * r);
+
+void ring_close(FrameRing * r);
+
+
+#endif // __UT_RING_H__
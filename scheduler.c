@@ -0,0 +1,489 @@
+#define _GNU_SOURCE
+#include "scheduler.h"
+#include "defs.h"
+#include "utils.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+    #include <linux/futex.h>
+    #include <sys/syscall.h>
+#endif
+
+#define SCHEDULER_MAX_THREADS 256
+// Service charged per job is SCHEDULER_VTIME_SCALE / weight
+#define SCHEDULER_VTIME_SCALE (1 << 16)
+
+
+typedef struct SchedulerJob {
+    scheduler_job_fn * fn;
+    void * arg;
+    SchedulerStream * stream;
+    // Children count of the submitting job, NULL from outside
+    int * parent;
+} SchedulerJob;
+
+// Ring buffer of jobs, grows on demand
+typedef struct JobQueue {
+    SchedulerJob * jobs;
+    uint32_t cap;
+    uint32_t head;
+    uint32_t count;
+} JobQueue;
+
+typedef struct SchedulerWorker {
+    Scheduler * s;
+    int index;
+    int cpu;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    JobQueue deque;
+} SchedulerWorker;
+
+struct SchedulerStream {
+    Scheduler * s;
+    SchedulerStream * next;
+    // Jobs submitted from outside of the workers, under s->lock
+    JobQueue queue;
+    int weight;
+    uint64_t vtime;
+    // Jobs not finished yet, nested ones included, under s->lock
+    int pending;
+    pthread_cond_t done;
+};
+
+struct Scheduler {
+    int threads;
+    int flags;
+    SchedulerWorker * workers;
+    int started;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    SchedulerStream * streams;
+    // Service of the last stream picked, idle streams resume from there
+    // so they can't claim the time they didn't use
+    uint64_t vtime;
+    int stop;
+
+    // Jobs waiting in the stream queues and the deques
+    int queued;
+    int sleepers;
+};
+
+static _Thread_local SchedulerWorker * current_worker;
+// Children count of the job running on this thread
+static _Thread_local int * current_children;
+
+static pthread_mutex_t global_lock = PTHREAD_MUTEX_INITIALIZER;
+static Scheduler * global;
+static int global_threads;
+static int global_flags;
+
+
+static int queue_push(JobQueue * q, SchedulerJob job) {
+    if (q->count == q->cap) {
+        uint32_t cap = q->cap ? q->cap * 2 : 64;
+        SchedulerJob * jobs = malloc(cap * sizeof(*jobs));
+
+        if (!jobs)
+            return AVERROR(ENOMEM);
+        for (uint32_t i = 0; i < q->count; i++)
+            jobs[i] = q->jobs[(q->head + i) % q->cap];
+        free(q->jobs);
+        q->jobs = jobs;
+        q->cap  = cap;
+        q->head = 0;
+    }
+    q->jobs[(q->head + q->count++) % q->cap] = job;
+    return 0;
+}
+
+static int queue_pop_front(JobQueue * q, SchedulerJob * job) {
+    if (!q->count)
+        return 0;
+    *job = q->jobs[q->head];
+    q->head = (q->head + 1) % q->cap;
+    q->count--;
+    return 1;
+}
+
+static int queue_pop_back(JobQueue * q, SchedulerJob * job) {
+    if (!q->count)
+        return 0;
+    *job = q->jobs[(q->head + --q->count) % q->cap];
+    return 1;
+}
+
+
+static void scheduler_wake(Scheduler * s) {
+    if (__atomic_load_n(&s->sleepers, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&s->lock);
+        pthread_cond_signal(&s->work);
+        pthread_mutex_unlock(&s->lock);
+    }
+}
+
+/**
+ * Own deque first (newest job, its data is likely still in cache), then
+ * the stream with the least weighted service, then the oldest job of
+ * another worker.
+ */
+static int scheduler_take(Scheduler * s, SchedulerWorker * self, SchedulerJob * job) {
+    SchedulerStream * best = NULL;
+    SchedulerWorker * victim;
+    int found = 0, start;
+
+    if (self) {
+        pthread_mutex_lock(&self->lock);
+        found = queue_pop_back(&self->deque, job);
+        pthread_mutex_unlock(&self->lock);
+        if (found)
+            goto end;
+    }
+
+    pthread_mutex_lock(&s->lock);
+    for (SchedulerStream * st = s->streams; st; st = st->next) {
+        if (st->queue.count && (!best || st->vtime < best->vtime))
+            best = st;
+    }
+    if (best) {
+        found = queue_pop_front(&best->queue, job);
+        s->vtime = best->vtime;
+        best->vtime += SCHEDULER_VTIME_SCALE /
+            __atomic_load_n(&best->weight, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&s->lock);
+    if (found)
+        goto end;
+
+    start = self ? self->index + 1 : 0;
+    for (int i = 0; i < s->threads && !found; i++) {
+        victim = &s->workers[(start + i) % s->threads];
+        if (victim == self)
+            continue;
+        pthread_mutex_lock(&victim->lock);
+        found = queue_pop_front(&victim->deque, job);
+        pthread_mutex_unlock(&victim->lock);
+    }
+    if (!found)
+        return 0;
+end:
+    __atomic_sub_fetch(&s->queued, 1, __ATOMIC_SEQ_CST);
+    return 1;
+}
+
+// Sleep while *children is still count, the last child to finish wakes
+// the parent. The count may be gone by then, a stale wake-up only makes
+// some other waiter check its own count again.
+static void children_wait(int * children, int count) {
+#ifdef __linux__
+    syscall(SYS_futex, children, FUTEX_WAIT_PRIVATE, count, NULL, NULL, 0);
+#else
+    (void)children;
+    (void)count;
+    sched_yield();
+#endif
+}
+
+static void children_done(int * children) {
+    if (!__atomic_sub_fetch(children, 1, __ATOMIC_RELEASE)) {
+#ifdef __linux__
+        syscall(SYS_futex, children, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#endif
+    }
+}
+
+static void scheduler_run(Scheduler * s, SchedulerJob * job);
+
+// Run other jobs until the children of the current one are done, they
+// only ever wait for their own children, so this can't go in circles.
+// With nothing left to take the children run on other workers, the
+// parent sleeps until the last one is done instead of spinning.
+static void scheduler_join(Scheduler * s, int * children) {
+    SchedulerJob job;
+    int count;
+
+    while ((count = __atomic_load_n(children, __ATOMIC_ACQUIRE))) {
+        if (scheduler_take(s, current_worker, &job))
+            scheduler_run(s, &job);
+        else
+            children_wait(children, count);
+    }
+}
+
+static void scheduler_run(Scheduler * s, SchedulerJob * job) {
+    SchedulerStream * st = job->stream;
+    int * outer = current_children;
+    int children = 0;
+
+    // A job is done once its children are, so they can't outlive it
+    current_children = &children;
+    job->fn(job->arg);
+    scheduler_join(s, &children);
+    current_children = outer;
+
+    if (job->parent)
+        children_done(job->parent);
+
+    // Under the lock, so a waiter can't free the stream before the signal
+    pthread_mutex_lock(&s->lock);
+    if (!--st->pending)
+        pthread_cond_broadcast(&st->done);
+    pthread_mutex_unlock(&s->lock);
+}
+
+static void * scheduler_worker(void * arg) {
+    SchedulerWorker * w = arg;
+    Scheduler * s = w->s;
+    SchedulerJob job;
+    int stop;
+
+    current_worker = w;
+
+    if (w->cpu >= 0) {
+        cpu_set_t set;
+
+        CPU_ZERO(&set);
+        CPU_SET(w->cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+
+    for (;;) {
+        if (scheduler_take(s, w, &job)) {
+            scheduler_run(s, &job);
+            continue;
+        }
+
+        // sleepers is raised before queued is checked, and submitters raise
+        // queued before checking sleepers, so one of them sees the other
+        pthread_mutex_lock(&s->lock);
+        __atomic_add_fetch(&s->sleepers, 1, __ATOMIC_SEQ_CST);
+        if (!__atomic_load_n(&s->queued, __ATOMIC_SEQ_CST) && !s->stop)
+            pthread_cond_wait(&s->work, &s->lock);
+        __atomic_sub_fetch(&s->sleepers, 1, __ATOMIC_SEQ_CST);
+        stop = s->stop;
+        pthread_mutex_unlock(&s->lock);
+
+        if (stop)
+            break;
+    }
+    return NULL;
+}
+
+
+Scheduler * scheduler_create(int threads, int flags) {
+    Scheduler * s;
+    cpu_set_t allowed;
+    int cpus[CPU_SETSIZE], ncpus = 0;
+
+    if (threads <= 0)
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = MIN(MAX(threads, 1), SCHEDULER_MAX_THREADS);
+
+    if ((flags & SCHEDULER_FLAG_PIN) && !sched_getaffinity(0, sizeof(allowed), &allowed)) {
+        for (int i = 0; i < CPU_SETSIZE; i++) {
+            if (CPU_ISSET(i, &allowed))
+                cpus[ncpus++] = i;
+        }
+    }
+
+    s = calloc(1, sizeof(*s));
+    if (!s)
+        return NULL;
+    s->threads = threads;
+    s->flags   = flags;
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->work, NULL);
+
+    s->workers = calloc(threads, sizeof(*s->workers));
+    if (!s->workers) {
+        scheduler_destroy(s);
+        return NULL;
+    }
+    for (int i = 0; i < threads; i++) {
+        SchedulerWorker * w = &s->workers[i];
+
+        w->s     = s;
+        w->index = i;
+        w->cpu   = ncpus ? cpus[i % ncpus] : -1;
+        pthread_mutex_init(&w->lock, NULL);
+    }
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&s->workers[i].thread, NULL, scheduler_worker, &s->workers[i])) {
+            scheduler_destroy(s);
+            return NULL;
+        }
+        s->started++;
+    }
+
+    return s;
+}
+
+int scheduler_global_init(int threads, int flags) {
+    int ret = 0;
+
+    pthread_mutex_lock(&global_lock);
+    if (global) {
+        ret = AVERROR(EBUSY);
+    } else {
+        global_threads = threads;
+        global_flags   = flags;
+    }
+    pthread_mutex_unlock(&global_lock);
+    return ret;
+}
+
+Scheduler * scheduler_global(void) {
+    Scheduler * s;
+
+    pthread_mutex_lock(&global_lock);
+    if (!global)
+        global = scheduler_create(global_threads, global_flags);
+    s = global;
+    pthread_mutex_unlock(&global_lock);
+    return s;
+}
+
+int scheduler_threads(const Scheduler * s) {
+    return s->threads;
+}
+
+
+SchedulerStream * scheduler_stream_open(Scheduler * s, int weight) {
+    SchedulerStream * st = calloc(1, sizeof(*st));
+
+    if (!st)
+        return NULL;
+    st->s = s;
+    pthread_cond_init(&st->done, NULL);
+    scheduler_stream_set_weight(st, weight);
+
+    pthread_mutex_lock(&s->lock);
+    st->vtime  = s->vtime;
+    st->next   = s->streams;
+    s->streams = st;
+    pthread_mutex_unlock(&s->lock);
+    return st;
+}
+
+void scheduler_stream_set_weight(SchedulerStream * st, int weight) {
+    if (weight <= 0)
+        weight = SCHEDULER_WEIGHT_DEFAULT;
+    __atomic_store_n(&st->weight, MIN(weight, SCHEDULER_WEIGHT_MAX), __ATOMIC_RELAXED);
+}
+
+static int scheduler_push(SchedulerStream * st, scheduler_job_fn * fn, void * arg, int detached) {
+    Scheduler * s = st->s;
+    SchedulerWorker * w = current_worker;
+    SchedulerJob job = { fn, arg, st, NULL };
+    int ret;
+
+    pthread_mutex_lock(&s->lock);
+    st->pending++;
+    if (detached || !w || w->s != s || !current_children) {
+        if (!st->queue.count)
+            st->vtime = MAX(st->vtime, s->vtime);
+        ret = queue_push(&st->queue, job);
+        if (ret < 0)
+            st->pending--;
+        pthread_mutex_unlock(&s->lock);
+    } else {
+        pthread_mutex_unlock(&s->lock);
+        job.parent = current_children;
+        __atomic_add_fetch(job.parent, 1, __ATOMIC_RELAXED);
+        pthread_mutex_lock(&w->lock);
+        ret = queue_push(&w->deque, job);
+        pthread_mutex_unlock(&w->lock);
+        if (ret < 0) {
+            __atomic_sub_fetch(job.parent, 1, __ATOMIC_RELAXED);
+            pthread_mutex_lock(&s->lock);
+            if (!--st->pending)
+                pthread_cond_broadcast(&st->done);
+            pthread_mutex_unlock(&s->lock);
+        }
+    }
+    if (ret < 0)
+        return ret;
+
+    __atomic_add_fetch(&s->queued, 1, __ATOMIC_SEQ_CST);
+    scheduler_wake(s);
+    return 0;
+}
+
+int scheduler_submit(SchedulerStream * st, scheduler_job_fn * fn, void * arg) {
+    return scheduler_push(st, fn, arg, 0);
+}
+
+int scheduler_submit_detached(SchedulerStream * st, scheduler_job_fn * fn, void * arg) {
+    return scheduler_push(st, fn, arg, 1);
+}
+
+void scheduler_stream_wait(SchedulerStream * st) {
+    Scheduler * s = st->s;
+    SchedulerWorker * w = current_worker;
+
+    // Blocking here could leave every worker waiting on jobs nobody runs
+    if (w && w->s == s && current_children) {
+        scheduler_join(s, current_children);
+        return;
+    }
+
+    pthread_mutex_lock(&s->lock);
+    while (st->pending)
+        pthread_cond_wait(&st->done, &s->lock);
+    pthread_mutex_unlock(&s->lock);
+}
+
+void scheduler_stream_close(SchedulerStream * st) {
+    Scheduler * s;
+
+    if (!st)
+        return;
+    s = st->s;
+    scheduler_stream_wait(st);
+
+    pthread_mutex_lock(&s->lock);
+    for (SchedulerStream ** p = &s->streams; *p; p = &(*p)->next) {
+        if (*p == st) {
+            *p = st->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    pthread_cond_destroy(&st->done);
+    free(st->queue.jobs);
+    free(st);
+}
+
+void scheduler_destroy(Scheduler * s) {
+    if (!s)
+        return;
+
+    pthread_mutex_lock(&s->lock);
+    s->stop = 1;
+    pthread_cond_broadcast(&s->work);
+    pthread_mutex_unlock(&s->lock);
+
+    for (int i = 0; i < s->started; i++)
+        pthread_join(s->workers[i].thread, NULL);
+    for (int i = 0; s->workers && i < s->threads; i++) {
+        pthread_mutex_destroy(&s->workers[i].lock);
+        free(s->workers[i].deque.jobs);
+    }
+
+    pthread_mutex_lock(&global_lock);
+    if (global == s)
+        global = NULL;
+    pthread_mutex_unlock(&global_lock);
+
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->work);
+    free(s->workers);
+    free(s);
+}
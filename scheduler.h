@@ -0,0 +1,88 @@
+#ifndef __UT_SCHEDULER_H__
+#define __UT_SCHEDULER_H__
+
+#include <stdint.h>
+
+// Pin worker i to the i-th CPU the process may run on
+#define SCHEDULER_FLAG_PIN 1
+
+#define SCHEDULER_WEIGHT_DEFAULT 4
+#define SCHEDULER_WEIGHT_MAX 64
+
+
+/**
+ * Process wide pool of decode threads, shared by any number of streams.
+ *
+ * Jobs are submitted on behalf of a stream. Every worker owns a deque:
+ * jobs submitted from inside a job (planes of a frame, slices of a plane)
+ * go to the deque of the worker running it, are popped back LIFO by that
+ * worker and stolen FIFO by idle ones. Jobs submitted from outside wait in
+ * their stream queue, a worker with an empty deque picks the stream with
+ * the least service relative to its weight, so a stream with twice the
+ * weight gets twice the jobs while others are competing.
+ *
+ * The library submits whole frames (batch and async decoding), and the
+ * slices of a frame when its context has threads set.
+ */
+typedef struct Scheduler Scheduler;
+typedef struct SchedulerStream SchedulerStream;
+
+typedef void (scheduler_job_fn)(void * arg);
+
+
+/**
+ * @param threads worker count, one per online CPU if 0
+ * @returns NULL on failure
+ */
+Scheduler * scheduler_create(int threads, int flags);
+
+/**
+ * Configure the shared scheduler, before its first use.
+ * @returns AVERROR(EBUSY) if it is already running
+ */
+int scheduler_global_init(int threads, int flags);
+
+/**
+ * The shared scheduler, created with default settings on first use.
+ */
+Scheduler * scheduler_global(void);
+
+int scheduler_threads(const Scheduler * s);
+
+/**
+ * @param weight relative share of the workers, SCHEDULER_WEIGHT_DEFAULT if 0
+ */
+SchedulerStream * scheduler_stream_open(Scheduler * s, int weight);
+
+void scheduler_stream_set_weight(SchedulerStream * st, int weight);
+
+int scheduler_submit(SchedulerStream * st, scheduler_job_fn * fn, void * arg);
+
+/**
+ * Submit a job to the stream queue even from inside a job, as if it came
+ * from outside. The job isn't a child of the running one, which neither
+ * waits for it nor runs it on its own stack. For jobs that submit the next
+ * one of a chain as they finish.
+ */
+int scheduler_submit_detached(SchedulerStream * st, scheduler_job_fn * fn, void * arg);
+
+/**
+ * Wait for every job of the stream, nested ones included. Called from a
+ * job it waits for the jobs that job submitted instead, running other
+ * jobs meanwhile rather than blocking the worker. A job returning without
+ * waiting is still only done once its children are.
+ */
+void scheduler_stream_wait(SchedulerStream * st);
+
+/**
+ * Waits for the stream jobs first.
+ */
+void scheduler_stream_close(SchedulerStream * st);
+
+/**
+ * Stops the workers once they are idle, the streams must be closed.
+ */
+void scheduler_destroy(Scheduler * s);
+
+
+#endif // __UT_SCHEDULER_H__
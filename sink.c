@@ -0,0 +1,419 @@
+#define _GNU_SOURCE
+#include "sink.h"
+#include "defs.h"
+#include "utils.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifndef O_DIRECT
+    #define O_DIRECT 0
+#endif
+
+// O_DIRECT wants the memory, the file offset and the size aligned,
+// a page covers the logical block size of any device
+#define SINK_ALIGN 4096
+#define SINK_MAX_DEPTH 64
+#define SINK_ALIGN_UP(x) (((x) + SINK_ALIGN - 1) & ~(size_t)(SINK_ALIGN - 1))
+
+#define Y4M_FRAME "FRAME\n"
+
+
+typedef struct SinkBuffer {
+    uint8_t * data;
+    size_t len;         // bytes to write from data
+    uint64_t offset;    // file offset of data, with positioned writes
+    int ready;
+} SinkBuffer;
+
+struct FrameSink {
+    int fd;
+    int format;
+    int depth;
+    // The buffers are block aligned and written at their offset, O_DIRECT
+    // is on while direct is set, it's dropped if the writes fail with it
+    int positioned;
+    int direct;
+    int fd_flags;
+
+    SinkBuffer * bufs;
+    size_t buf_size;
+    // Filled in order from head, written in order from tail
+    int head;
+    int tail;
+
+    // Output bytes so far, after base, the file offset on open.
+    // carry holds the ones past the last block boundary.
+    uint64_t base;
+    uint64_t pos;
+    uint8_t * carry;
+    size_t carry_len;
+
+    // The Y4M header is written with the first frame, the others match it
+    uint32_t frames;
+    uint16_t w, h;
+    uint8_t video_format;
+
+    int error;
+    pthread_t thread;
+    int thread_started;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int stop;
+};
+
+
+static size_t frame_bytes(const VideoContext * ctx) {
+    size_t size = 0;
+
+    if (ctx->preview_shift) {
+        if (video_is_rgb(ctx))
+            return (size_t)ctx->preview_w[0] * ctx->preview_h[0] * 4;
+        for (int i = 0; i < ctx->planes; i++)
+            size += (size_t)ctx->preview_w[i] * ctx->preview_h[i];
+        return size;
+    }
+    if (ctx->tensor_data)
+        return ctx->tensor_size;
+    if (ctx->yuv_data[0]) {
+        for (int i = 0; i < 3 && ctx->yuv_data[i]; i++)
+            size += (size_t)ctx->yuv_linesize[i] * (i ? (ctx->h + 1) >> 1 : ctx->h);
+        return size;
+    }
+    if (video_is_rgb(ctx))
+        return (size_t)ctx->w * ctx->h * 4;
+    for (int i = 0; i < ctx->planes; i++)
+        size += (size_t)ctx->plane_w[i] * ctx->plane_h[i];
+    return size;
+}
+
+// Rows without the line padding, RGBA for RGB and the planes for YUV or
+// YUV output. The float planes have no padding to begin with.
+// The preview is packed already, and replaces the frame when there's one.
+static uint8_t * pack_frame(uint8_t * dst, const VideoContext * ctx) {
+    size_t size;
+
+    if (ctx->preview_shift) {
+        if (video_is_rgb(ctx)) {
+            size = (size_t)ctx->preview_w[0] * ctx->preview_h[0] * 4;
+            memcpy(dst, ctx->preview_rgba, size);
+            return dst + size;
+        }
+        for (int i = 0; i < ctx->planes; i++) {
+            size = (size_t)ctx->preview_w[i] * ctx->preview_h[i];
+            memcpy(dst, ctx->preview_data[i], size);
+            dst += size;
+        }
+        return dst;
+    }
+    if (ctx->tensor_data) {
+        memcpy(dst, ctx->tensor_data, ctx->tensor_size);
+        return dst + ctx->tensor_size;
+    }
+    if (ctx->yuv_data[0]) {
+        for (int i = 0; i < 3 && ctx->yuv_data[i]; i++) {
+            int rows = i ? (ctx->h + 1) >> 1 : ctx->h;
+            for (int y = 0; y < rows; y++) {
+                memcpy(dst, ctx->yuv_data[i] + (size_t)y * ctx->yuv_linesize[i], ctx->yuv_linesize[i]);
+                dst += ctx->yuv_linesize[i];
+            }
+        }
+        return dst;
+    }
+    if (video_is_rgb(ctx)) {
+        for (int y = 0; y < ctx->h; y++) {
+            memcpy(dst, ctx->result_frame_data + (size_t)y * ctx->linesize[0], ctx->w * 4);
+            dst += ctx->w * 4;
+        }
+        return dst;
+    }
+    for (int i = 0; i < ctx->planes; i++) {
+        for (int y = 0; y < ctx->plane_h[i]; y++) {
+            memcpy(dst, ctx->frame_data[i] + (size_t)y * ctx->linesize[i], ctx->plane_w[i]);
+            dst += ctx->plane_w[i];
+        }
+    }
+    return dst;
+}
+
+static int y4m_header(char * buf, size_t size, const VideoContext * ctx) {
+    const char * chroma = "444";
+
+    switch (ctx->yuv_data[0] ? UT_FMT_YUV420 : ctx->format) {
+        case UT_FMT_YUV420:
+            chroma = "420jpeg";
+            break;
+        case UT_FMT_YUV422:
+            chroma = "422";
+            break;
+    }
+    // Headers without a frame rate are taken as 25 fps
+    return snprintf(
+        buf, size, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C%s\n",
+        ctx->preview_shift ? ctx->preview_w[0] : ctx->w,
+        ctx->preview_shift ? ctx->preview_h[0] : ctx->h,
+        ctx->fps ? ctx->fps : 25, chroma
+    );
+}
+
+static int write_all(FrameSink * s, struct iovec * iov, int n, uint64_t offset) {
+    ssize_t r;
+
+    while (n > 0) {
+        if (!iov->iov_len) {
+            iov++;
+            n--;
+            continue;
+        }
+        if (s->positioned)
+            r = pwritev(s->fd, iov, n, offset);
+        else
+            r = writev(s->fd, iov, n);
+
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r < 0 && errno == EINVAL && s->direct) {
+            // Some filesystems take the flag, but not the writes
+            pthread_mutex_lock(&s->lock);
+            fcntl(s->fd, F_SETFL, s->fd_flags);
+            s->direct = 0;
+            pthread_mutex_unlock(&s->lock);
+            continue;
+        }
+        if (r <= 0)
+            return AVERROR(r < 0 ? errno : EIO);
+
+        offset += r;
+        for (; n && (size_t)r >= iov->iov_len; iov++, n--)
+            r -= iov->iov_len;
+        if (n) {
+            iov->iov_base = (uint8_t *)iov->iov_base + r;
+            iov->iov_len -= r;
+        }
+    }
+    return 0;
+}
+
+static void * writer_thread(void * arg) {
+    FrameSink * s = arg;
+    struct iovec iov[SINK_MAX_DEPTH];
+    uint64_t offset;
+    int n, ret;
+
+    for (;;) {
+        pthread_mutex_lock(&s->lock);
+        while (!s->bufs[s->tail].ready && !s->stop)
+            pthread_cond_wait(&s->cond, &s->lock);
+
+        // Everything ready goes in one call, the buffers follow each other
+        // in the output. What is queued is written before stopping.
+        n = 0;
+        for (int i = s->tail; n < s->depth && s->bufs[i].ready; i = (i + 1) % s->depth)
+            iov[n++] = (struct iovec){ s->bufs[i].data, s->bufs[i].len };
+        offset = s->bufs[s->tail].offset;
+        ret = s->error;
+        pthread_mutex_unlock(&s->lock);
+        if (!n)
+            break;
+
+        // After a failure the buffers are only released
+        if (!ret)
+            ret = write_all(s, iov, n, offset);
+
+        pthread_mutex_lock(&s->lock);
+        if (ret < 0 && !s->error)
+            s->error = ret;
+        for (int i = 0; i < n; i++) {
+            s->bufs[s->tail].ready = 0;
+            s->tail = (s->tail + 1) % s->depth;
+        }
+        pthread_cond_broadcast(&s->cond);
+        pthread_mutex_unlock(&s->lock);
+    }
+    return NULL;
+}
+
+// Wait for the writer to catch up and reallocate the buffers for a larger frame
+static int sink_grow(FrameSink * s, size_t size) {
+    pthread_mutex_lock(&s->lock);
+    for (int i = 0; i < s->depth; i++) {
+        while (s->bufs[i].ready)
+            pthread_cond_wait(&s->cond, &s->lock);
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    for (int i = 0; i < s->depth; i++) {
+        free(s->bufs[i].data);
+        s->bufs[i].data = aligned_alloc(SINK_ALIGN, size);
+        if (!s->bufs[i].data) {
+            s->buf_size = 0;
+            return AVERROR(ENOMEM);
+        }
+    }
+    s->buf_size = size;
+    return 0;
+}
+
+
+FrameSink * sink_open(int fd, int format, int depth, int flags) {
+    FrameSink * s;
+    struct stat st;
+    off_t offset;
+
+    s = calloc(1, sizeof(*s));
+    if (!s)
+        return NULL;
+
+    s->fd     = fd;
+    s->format = format;
+    s->depth  = depth > 0 ? MIN(depth, SINK_MAX_DEPTH) : SINK_DEFAULT_DEPTH;
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->cond, NULL);
+
+    s->bufs  = calloc(s->depth, sizeof(*s->bufs));
+    s->carry = aligned_alloc(SINK_ALIGN, SINK_ALIGN);
+    if (!s->bufs || !s->carry)
+        goto fail;
+
+    // Positioned writes need a regular file and ignore the offset with
+    // O_APPEND, O_DIRECT needs the output to start on a block
+    s->fd_flags = fcntl(fd, F_GETFL);
+    if ((flags & SINK_FLAG_DIRECT) && O_DIRECT && s->fd_flags >= 0 &&
+        !(s->fd_flags & O_APPEND) && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+        (offset = lseek(fd, 0, SEEK_CUR)) >= 0 && !(offset % SINK_ALIGN) &&
+        fcntl(fd, F_SETFL, s->fd_flags | O_DIRECT) == 0) {
+        s->positioned = 1;
+        s->direct     = 1;
+        s->base       = offset;
+    }
+
+    if (pthread_create(&s->thread, NULL, writer_thread, s))
+        goto fail;
+    s->thread_started = 1;
+    return s;
+fail:
+    sink_close(s);
+    return NULL;
+}
+
+int sink_write(FrameSink * s, const VideoContext * ctx) {
+    char header[64];
+    int header_len = 0, ret;
+    size_t size;
+    SinkBuffer * b;
+    uint8_t * p;
+
+    if (!ctx->planes || (video_is_rgb(ctx) && ctx->output_format == UT_OUTPUT_NONE))
+        return AVERROR(EINVAL);
+
+    size = frame_bytes(ctx);
+    if (s->format == SINK_FORMAT_Y4M) {
+        // Y4M has no RGB or NV12, and no way to change the frame size
+        if (ctx->yuv_data[0] ? !ctx->yuv_data[2] : video_is_rgb(ctx))
+            return AVERROR(EINVAL);
+        if (!s->frames) {
+            header_len = y4m_header(header, sizeof(header), ctx);
+            s->w = ctx->w;
+            s->h = ctx->h;
+            s->video_format = ctx->format;
+        } else if (ctx->w != s->w || ctx->h != s->h || ctx->format != s->video_format) {
+            return AVERROR(EINVAL);
+        }
+        size += header_len + strlen(Y4M_FRAME);
+    }
+
+    // Room for the carried bytes in front
+    if (SINK_ALIGN_UP(SINK_ALIGN + size) > s->buf_size) {
+        if ((ret = sink_grow(s, SINK_ALIGN_UP(SINK_ALIGN + size))) < 0)
+            return ret;
+    }
+
+    b = &s->bufs[s->head];
+    pthread_mutex_lock(&s->lock);
+    while (b->ready && !s->error)
+        pthread_cond_wait(&s->cond, &s->lock);
+    ret = s->error;
+    pthread_mutex_unlock(&s->lock);
+    if (ret < 0)
+        return ret;
+
+    p = b->data;
+    if (s->positioned) {
+        memcpy(p, s->carry, s->carry_len);
+        p += s->carry_len;
+    }
+    if (s->format == SINK_FORMAT_Y4M) {
+        memcpy(p, header, header_len);
+        p += header_len;
+        memcpy(p, Y4M_FRAME, strlen(Y4M_FRAME));
+        p += strlen(Y4M_FRAME);
+    }
+    p = pack_frame(p, ctx);
+
+    b->len    = p - b->data;
+    b->offset = s->base + s->pos - s->carry_len;
+    if (s->positioned) {
+        // Whole blocks only, the rest starts the next buffer
+        s->carry_len = b->len & (SINK_ALIGN - 1);
+        b->len -= s->carry_len;
+        memcpy(s->carry, b->data + b->len, s->carry_len);
+    }
+    s->pos += size;
+    s->frames++;
+
+    pthread_mutex_lock(&s->lock);
+    b->ready = 1;
+    s->head  = (s->head + 1) % s->depth;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+    return 0;
+}
+
+int sink_direct(const FrameSink * s) {
+    return s->direct;
+}
+
+int sink_close(FrameSink * s) {
+    struct iovec tail;
+    int ret;
+
+    if (!s)
+        return 0;
+
+    if (s->thread_started) {
+        pthread_mutex_lock(&s->lock);
+        s->stop = 1;
+        pthread_cond_broadcast(&s->cond);
+        pthread_mutex_unlock(&s->lock);
+        pthread_join(s->thread, NULL);
+    }
+    ret = s->error;
+
+    if (s->positioned) {
+        // The bytes past the last block go through the page cache
+        if (s->direct)
+            fcntl(s->fd, F_SETFL, s->fd_flags);
+        s->direct = 0;
+        if (!ret && s->carry_len) {
+            tail = (struct iovec){ s->carry, s->carry_len };
+            ret = write_all(s, &tail, 1, s->base + s->pos - s->carry_len);
+        }
+        lseek(s->fd, s->base + s->pos, SEEK_SET);
+    }
+
+    for (int i = 0; s->bufs && i < s->depth; i++)
+        free(s->bufs[i].data);
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->cond);
+    free(s->bufs);
+    free(s->carry);
+    free(s);
+    return ret;
+}
@@ -0,0 +1,59 @@
+#ifndef __UT_SINK_H__
+#define __UT_SINK_H__
+
+#include "video.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#define SINK_DEFAULT_DEPTH 4
+
+// Write with O_DIRECT when the fd is a regular file that takes it
+#define SINK_FLAG_DIRECT 1
+
+enum {
+    SINK_FORMAT_RAW,    // RGBA rows for RGB, or its output format, the planes back to back for YUV
+    SINK_FORMAT_Y4M,    // YUV formats only
+};
+
+
+/**
+ * Write-behind frame output, the counterpart of PacketSource.
+ *
+ * Frames are copied into a pool of depth buffers, in the output format,
+ * and written by a dedicated thread while the next ones decode. The thread
+ * writes all the buffers that are ready with one writev. With O_DIRECT the
+ * buffers are block aligned and written at their file offset, the bytes
+ * short of a block move on to the next buffer and the last ones are written
+ * through the page cache on close.
+ */
+typedef struct FrameSink FrameSink;
+
+
+/**
+ * @param fd    stays owned by the caller, must outlive the sink
+ * @param depth number of buffers, SINK_DEFAULT_DEPTH if 0
+ * @returns NULL on failure
+ */
+FrameSink * sink_open(int fd, int format, int depth, int flags);
+
+/**
+ * Queue the frame decoded in ctx, or its preview if it makes one,
+ * waiting for a free buffer if the writer is behind.
+ * @returns 0 or a negative AVERROR, also for an earlier failed write
+ */
+int sink_write(FrameSink * s, const VideoContext * ctx);
+
+/**
+ * Whether the writes go around the page cache.
+ */
+int sink_direct(const FrameSink * s);
+
+/**
+ * Write what is queued and release the sink, the fd is left at the end
+ * of the output.
+ * @returns 0 or the first error
+ */
+int sink_close(FrameSink * s);
+
+
+#endif // __UT_SINK_H__
@@ -0,0 +1,528 @@
+#define _GNU_SOURCE
+#include "source.h"
+#include "defs.h"
+#include "mem.h"
+#include "utils.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// io_uring is driven through the raw syscalls, so there is no liburing dependency
+#ifdef __linux__
+    #include <linux/io_uring.h>
+    #include <sys/mman.h>
+    #include <sys/syscall.h>
+    #include <sys/uio.h>
+    #define UT_HAVE_URING 1
+#else
+    #define UT_HAVE_URING 0
+#endif
+
+
+enum {
+    CHUNK_FREE,     // waiting for the reader
+    CHUNK_PENDING,  // read in flight
+    CHUNK_READY,
+};
+
+typedef struct SourceChunk {
+    uint8_t * data;
+    uint64_t offset;
+    uint32_t filled;
+    uint64_t skipped;   // bytes a skip passed over right before the chunk
+    int last;       // nothing follows this chunk (end of file or error)
+    int error;      // with last, the AVERROR of the read or 0 at the end
+    int state;
+} SourceChunk;
+
+#if UT_HAVE_URING
+typedef struct SourceRing {
+    int fd;
+    int fixed;      // the chunk pool is registered
+    unsigned * sq_tail, * sq_mask, * sq_array;
+    unsigned * cq_head, * cq_tail, * cq_mask;
+    struct io_uring_sqe * sqes;
+    struct io_uring_cqe * cqes;
+    void * sq_ptr, * cq_ptr;
+    size_t sq_size, cq_size, sqes_size;
+} SourceRing;
+#endif
+
+struct PacketSource {
+    int fd;
+    int backend;
+    int depth;
+    uint32_t chunk_size;
+    uint8_t * pool;
+    SourceChunk * chunks;
+
+    // The chunks are consumed in order, head is the one being read from
+    int head;
+    uint32_t pos;
+    uint64_t next_offset;
+
+#if UT_HAVE_URING
+    SourceRing ring;
+#endif
+
+    pthread_t thread;
+    int thread_started;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int stop;
+    // Written by source_close, wakes the reader waiting on a quiet pipe
+    int wake[2];
+
+    // Why the last read or skip came up short, 0 at the end of the file
+    int error;
+};
+
+
+#if UT_HAVE_URING
+
+static void uring_free(SourceRing * r) {
+    if (r->sqes)
+        munmap(r->sqes, r->sqes_size);
+    if (r->cq_ptr && r->cq_ptr != r->sq_ptr)
+        munmap(r->cq_ptr, r->cq_size);
+    if (r->sq_ptr)
+        munmap(r->sq_ptr, r->sq_size);
+    if (r->fd >= 0)
+        close(r->fd);
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+}
+
+static void * uring_map(int fd, size_t size, off_t offset) {
+    void * ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+    return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+static int uring_init(PacketSource * s) {
+    SourceRing * r = &s->ring;
+    struct io_uring_params p;
+    struct iovec * iov;
+    uint8_t * sq, * cq;
+
+    memset(&p, 0, sizeof(p));
+    r->fd = syscall(__NR_io_uring_setup, s->depth, &p);
+    if (r->fd < 0)
+        return AVERROR(errno);
+
+    r->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        r->sq_size = r->cq_size = MAX(r->sq_size, r->cq_size);
+
+    r->sq_ptr = uring_map(r->fd, r->sq_size, IORING_OFF_SQ_RING);
+    if (!r->sq_ptr)
+        goto fail;
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        r->cq_ptr = r->sq_ptr;
+    else if (!(r->cq_ptr = uring_map(r->fd, r->cq_size, IORING_OFF_CQ_RING)))
+        goto fail;
+
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = uring_map(r->fd, r->sqes_size, IORING_OFF_SQES);
+    if (!r->sqes)
+        goto fail;
+
+    sq = r->sq_ptr;
+    cq = r->cq_ptr;
+    r->sq_tail  = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask  = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->cq_head  = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail  = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask  = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes     = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    // Fixed buffers save the page pinning per read, but they count against
+    // RLIMIT_MEMLOCK on older kernels, plain reads do if it's too low
+    iov = malloc(s->depth * sizeof(*iov));
+    if (!iov)
+        goto fail;
+    for (int i = 0; i < s->depth; i++) {
+        iov[i].iov_base = s->chunks[i].data;
+        iov[i].iov_len  = s->chunk_size;
+    }
+    r->fixed = syscall(
+        __NR_io_uring_register, r->fd, IORING_REGISTER_BUFFERS, iov, s->depth
+    ) == 0;
+    free(iov);
+
+    return 0;
+fail:
+    uring_free(r);
+    return AVERROR(ENOMEM);
+}
+
+static int uring_enter(SourceRing * r, unsigned to_submit, unsigned wait) {
+    int ret;
+
+    do {
+        ret = syscall(
+            __NR_io_uring_enter, r->fd, to_submit, wait,
+            wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0
+        );
+    } while (ret < 0 && errno == EINTR);
+
+    return ret < 0 ? AVERROR(errno) : ret;
+}
+
+// Queue the rest of a chunk, every chunk has at most one read in flight
+static int uring_queue(PacketSource * s, int idx) {
+    SourceRing * r = &s->ring;
+    SourceChunk * c = &s->chunks[idx];
+    unsigned tail = *r->sq_tail;
+    unsigned i = tail & *r->sq_mask;
+    struct io_uring_sqe * sqe = &r->sqes[i];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode    = r->fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    sqe->fd        = s->fd;
+    sqe->addr      = (uintptr_t)(c->data + c->filled);
+    sqe->len       = s->chunk_size - c->filled;
+    sqe->off       = c->offset + c->filled;
+    sqe->buf_index = idx;
+    sqe->user_data = idx;
+    r->sq_array[i] = i;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    c->state = CHUNK_PENDING;
+    return uring_enter(r, 1, 0);
+}
+
+// Reap one completion, waiting for it if none is there
+static int uring_reap(PacketSource * s) {
+    SourceRing * r = &s->ring;
+    unsigned head = *r->cq_head;
+    struct io_uring_cqe * cqe;
+    SourceChunk * c;
+    int ret, res;
+
+    if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+        ret = uring_enter(r, 0, 1);
+        return ret < 0 ? ret : 0;
+    }
+
+    cqe = &r->cqes[head & *r->cq_mask];
+    c   = &s->chunks[cqe->user_data];
+    res = cqe->res;
+    __atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+
+    if (res == -EINTR || res == -EAGAIN)
+        return uring_queue(s, cqe->user_data);
+
+    if (res > 0) {
+        c->filled += res;
+        // short read in the middle of the file, ask for the rest
+        if (c->filled < s->chunk_size)
+            return uring_queue(s, c - s->chunks);
+    }
+    c->last  = res <= 0;
+    c->error = res < 0 ? res : 0;
+    c->state = CHUNK_READY;
+    return 0;
+}
+
+#endif
+
+
+static void * reader_thread(void * arg) {
+    PacketSource * s = arg;
+    SourceChunk * c;
+    ssize_t n;
+    int idx = 0;
+
+    for (;;) {
+        c = &s->chunks[idx];
+
+        pthread_mutex_lock(&s->lock);
+        while (c->state != CHUNK_FREE && !s->stop)
+            pthread_cond_wait(&s->cond, &s->lock);
+        if (s->stop) {
+            pthread_mutex_unlock(&s->lock);
+            break;
+        }
+        c->state = CHUNK_PENDING;
+        pthread_mutex_unlock(&s->lock);
+
+        // A pipe or socket can stay quiet for any time, wait for it along
+        // with source_close rather than in read()
+        struct pollfd pfd[2] = {
+            { .fd = s->fd, .events = POLLIN },
+            { .fd = s->wake[0], .events = POLLIN },
+        };
+        while (poll(pfd, 2, -1) < 0 && errno == EINTR)
+            ;
+        if (pfd[1].revents)
+            break;
+
+        // Hand over whatever a single read returns, pipes and sockets
+        // shouldn't wait for a whole chunk
+        do {
+            n = read(s->fd, c->data, s->chunk_size);
+        } while (n < 0 && errno == EINTR);
+
+        pthread_mutex_lock(&s->lock);
+        c->filled = n > 0 ? n : 0;
+        c->last   = n <= 0;
+        c->error  = n < 0 ? AVERROR(errno) : 0;
+        c->state  = CHUNK_READY;
+        pthread_cond_broadcast(&s->cond);
+        pthread_mutex_unlock(&s->lock);
+
+        if (n <= 0)
+            break;
+        idx = (idx + 1) % s->depth;
+    }
+    return NULL;
+}
+
+
+static int wait_chunk(PacketSource * s, int idx) {
+    SourceChunk * c = &s->chunks[idx];
+    int ret = 0;
+
+#if UT_HAVE_URING
+    if (s->backend == SOURCE_BACKEND_URING) {
+        while (c->state != CHUNK_READY && ret >= 0)
+            ret = uring_reap(s);
+        return ret;
+    }
+#endif
+
+    pthread_mutex_lock(&s->lock);
+    while (c->state != CHUNK_READY)
+        pthread_cond_wait(&s->cond, &s->lock);
+    pthread_mutex_unlock(&s->lock);
+    return ret;
+}
+
+// Give a drained chunk back to the reader, for the next part of the file
+static int release_chunk(PacketSource * s, int idx) {
+    SourceChunk * c = &s->chunks[idx];
+
+#if UT_HAVE_URING
+    if (s->backend == SOURCE_BACKEND_URING) {
+        c->offset  = s->next_offset;
+        c->filled  = 0;
+        c->skipped = 0;
+        c->last    = 0;
+        c->error   = 0;
+        s->next_offset += s->chunk_size;
+        return uring_queue(s, idx);
+    }
+#endif
+
+    pthread_mutex_lock(&s->lock);
+    c->filled = 0;
+    c->last   = 0;
+    c->error  = 0;
+    c->state  = CHUNK_FREE;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+    return 0;
+}
+
+
+PacketSource * source_open(int fd, int depth, uint32_t chunk_size, int flags) {
+    PacketSource * s;
+    struct stat st;
+    int ret;
+
+    s = calloc(1, sizeof(*s));
+    if (!s)
+        return NULL;
+
+    s->fd         = fd;
+    s->depth      = depth > 0 ? depth : SOURCE_DEFAULT_DEPTH;
+    s->chunk_size = chunk_size ? chunk_size : SOURCE_DEFAULT_CHUNK_SIZE;
+    s->backend    = SOURCE_BACKEND_THREAD;
+    s->wake[0]    = -1;
+    s->wake[1]    = -1;
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->cond, NULL);
+#if UT_HAVE_URING
+    s->ring.fd = -1;
+#endif
+
+    s->pool   = av_malloc((size_t)s->depth * s->chunk_size);
+    s->chunks = calloc(s->depth, sizeof(*s->chunks));
+    if (!s->pool || !s->chunks)
+        goto fail;
+    for (int i = 0; i < s->depth; i++)
+        s->chunks[i].data = s->pool + (size_t)i * s->chunk_size;
+
+#if UT_HAVE_URING
+    // Reads at offsets need a regular file, the rest goes to the thread
+    if (!(flags & SOURCE_FLAG_NO_URING) && fstat(fd, &st) == 0 &&
+        S_ISREG(st.st_mode) && uring_init(s) == 0) {
+        s->backend = SOURCE_BACKEND_URING;
+        s->next_offset = lseek(fd, 0, SEEK_CUR);
+        for (int i = 0; i < s->depth; i++) {
+            if ((ret = release_chunk(s, i)) < 0)
+                goto fail;
+        }
+        return s;
+    }
+#else
+    (void)st;
+    (void)ret;
+#endif
+
+    if (pipe2(s->wake, O_CLOEXEC) < 0 ||
+        pthread_create(&s->thread, NULL, reader_thread, s))
+        goto fail;
+    s->thread_started = 1;
+    return s;
+fail:
+    source_close(s);
+    return NULL;
+}
+
+size_t source_read(PacketSource * s, void * dst, size_t size) {
+    SourceChunk * c;
+    size_t done = 0, n;
+    int ret;
+
+    while (done < size) {
+        c = &s->chunks[s->head];
+        if ((ret = wait_chunk(s, s->head)) < 0) {
+            s->error = ret;
+            break;
+        }
+
+        n = MIN(c->filled - s->pos, size - done);
+        memcpy((uint8_t *)dst + done, c->data + s->pos, n);
+        done   += n;
+        s->pos += n;
+
+        if (s->pos < c->filled)
+            break;
+        if (c->last) {
+            s->error = c->error;
+            break;
+        }
+        if ((ret = release_chunk(s, s->head)) < 0) {
+            s->error = ret;
+            break;
+        }
+        s->head = (s->head + 1) % s->depth;
+        s->pos  = 0;
+    }
+
+    return done;
+}
+
+size_t source_skip(PacketSource * s, size_t size) {
+    SourceChunk * c;
+    size_t done = 0, n;
+    uint64_t jump;
+    int ret;
+
+    while (done < size) {
+        c = &s->chunks[s->head];
+        if ((ret = wait_chunk(s, s->head)) < 0) {
+            s->error = ret;
+            break;
+        }
+
+        // Bytes passed over without reading them
+        n = MIN(c->skipped, size - done);
+        done += n;
+        c->skipped -= n;
+        n = MIN(c->filled - s->pos, size - done);
+        done   += n;
+        s->pos += n;
+
+        if (s->pos < c->filled)
+            break;
+        if (c->last) {
+            s->error = c->error;
+            break;
+        }
+        jump = 0;
+#if UT_HAVE_URING
+        // The chunks in flight end at next_offset, if the skip goes further
+        // this one is read from its end instead of the bytes in between
+        if (s->backend == SOURCE_BACKEND_URING) {
+            const uint64_t ahead = s->next_offset - (c->offset + c->filled);
+            struct stat st;
+
+            // Not past the end of the file, the skip has to fall short there
+            if (size - done > ahead && fstat(s->fd, &st) == 0 &&
+                (uint64_t)st.st_size > s->next_offset) {
+                jump = MIN(size - done - ahead, st.st_size - s->next_offset);
+                s->next_offset += jump;
+            }
+        }
+#endif
+        if ((ret = release_chunk(s, s->head)) < 0) {
+            s->error = ret;
+            break;
+        }
+        c->skipped = jump;
+        s->head = (s->head + 1) % s->depth;
+        s->pos  = 0;
+    }
+
+    return done;
+}
+
+int source_backend(const PacketSource * s) {
+    return s->backend;
+}
+
+int source_error(const PacketSource * s) {
+    return s->error;
+}
+
+void source_close(PacketSource * s) {
+    if (!s)
+        return;
+
+#if UT_HAVE_URING
+    if (s->backend == SOURCE_BACKEND_URING) {
+        // The reads in flight target the pool, let them land first
+        for (int i = 0; i < s->depth; i++) {
+            while (s->chunks[i].state == CHUNK_PENDING) {
+                if (uring_reap(s) < 0)
+                    break;
+            }
+        }
+    }
+    if (s->ring.fd >= 0)
+        uring_free(&s->ring);
+#endif
+
+    if (s->thread_started) {
+        const uint8_t one = 1;
+
+        pthread_mutex_lock(&s->lock);
+        s->stop = 1;
+        pthread_cond_broadcast(&s->cond);
+        pthread_mutex_unlock(&s->lock);
+        // Written once, an empty pipe has room for it
+        if (write(s->wake[1], &one, sizeof(one)) < 0)
+            log_info("Reader wake-up failed\n");
+        pthread_join(s->thread, NULL);
+    }
+    for (int i = 0; i < 2; i++) {
+        if (s->wake[i] >= 0)
+            close(s->wake[i]);
+    }
+
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->cond);
+    free(s->chunks);
+    free(s->pool);
+    free(s);
+}
@@ -0,0 +1,67 @@
+#ifndef __UT_SOURCE_H__
+#define __UT_SOURCE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SOURCE_DEFAULT_DEPTH 8
+#define SOURCE_DEFAULT_CHUNK_SIZE (1 << 20)
+
+// Don't try io_uring, read ahead from a thread right away
+#define SOURCE_FLAG_NO_URING 1
+
+enum {
+    SOURCE_BACKEND_URING,
+    SOURCE_BACKEND_THREAD,
+};
+
+
+/**
+ * Read-ahead byte source for the demuxer.
+ *
+ * The file is read in chunks of chunk_size into a pool of depth buffers,
+ * all but the one being consumed are in flight at any time, so reading
+ * the next packet rarely waits on the storage. Regular files go through
+ * io_uring with the pool registered as fixed buffers, anything else (or
+ * a kernel without io_uring) is read by a dedicated thread.
+ */
+typedef struct PacketSource PacketSource;
+
+
+/**
+ * @param fd         stays owned by the caller, must outlive the source
+ * @param depth      number of chunks, SOURCE_DEFAULT_DEPTH if 0
+ * @param chunk_size SOURCE_DEFAULT_CHUNK_SIZE if 0
+ * @returns NULL on failure
+ */
+PacketSource * source_open(int fd, int depth, uint32_t chunk_size, int flags);
+
+/**
+ * Copy the next size bytes out of the read-ahead chunks,
+ * waiting for them if they are still in flight.
+ * @returns the bytes copied, less than size at the end or on errors
+ */
+size_t source_read(PacketSource * s, void * dst, size_t size);
+
+/**
+ * Move past the next size bytes without copying them. With io_uring, the
+ * parts beyond the chunks already in flight aren't read at all.
+ * @returns the bytes skipped, less than size at the end or on errors
+ */
+size_t source_skip(PacketSource * s, size_t size);
+
+int source_backend(const PacketSource * s);
+
+/**
+ * Why source_read or source_skip last came up short.
+ * @returns 0 at the end of the file, a negative AVERROR if reading failed
+ */
+int source_error(const PacketSource * s);
+
+/**
+ * Stops the reader, also while it waits on a pipe or socket without data.
+ */
+void source_close(PacketSource * s);
+
+
+#endif // __UT_SOURCE_H__
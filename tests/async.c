@@ -0,0 +1,163 @@
+// Decodes a stream through the callback of the asynchronous API, each
+// completed frame submitting the next packet from the worker that decoded
+// it. The packets are decoded loops times over, the frame hashes of every
+// loop have to match the first one.
+
+#include "async.h"
+#include "mem.h"
+#include "parser.h"
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CHUNK_SIZE (1 << 20)
+
+
+typedef struct Driver {
+    VideoAsync * a;
+    VideoPacket * pkts;
+    uint64_t * hashes;
+    uint32_t count;
+    uint64_t total;
+
+    uint64_t next;          // the next packet to submit, under lock
+    uint64_t done;
+    uint64_t errors;
+    pthread_mutex_t lock;
+    pthread_cond_t finished;
+} Driver;
+
+
+// Under d->lock
+static void submit_next(Driver * d) {
+    uint64_t tag;
+
+    if (d->next >= d->total)
+        return;
+    tag = d->next++;
+    if (async_submit(d->a, &d->pkts[tag % d->count], tag) < 0) {
+        d->errors++;
+        d->done++;
+    }
+}
+
+static void frame_done(void * opaque, const AsyncCompletion * c) {
+    Driver * d = opaque;
+    const uint32_t i = c->tag % d->count;
+
+    pthread_mutex_lock(&d->lock);
+    if (c->status < 0 || (c->tag >= d->count && c->frame->frame_hash != d->hashes[i]))
+        d->errors++;
+    else if (c->tag < d->count)
+        d->hashes[i] = c->frame->frame_hash;
+    submit_next(d);
+    if (++d->done == d->total)
+        pthread_cond_signal(&d->finished);
+    pthread_mutex_unlock(&d->lock);
+}
+
+int main(int argc, char ** argv) {
+    if (argc < 2) {
+        printf("Usage: %s <lav file (in)> [depth] [loops]\n", argv[0]);
+        return 1;
+    }
+    int fd_in = open(argv[1], O_RDONLY);
+    int depth = argc > 2 ? atoi(argv[2]) : 2;
+    int loops = argc > 3 ? atoi(argv[3]) : 1;
+    uint8_t * chunk = malloc(CHUNK_SIZE);
+
+    if (depth < 2 || loops < 1) {
+        printf("The depth is at least 2, the loops at least 1\n");
+        return 1;
+    }
+    if (fd_in < 0 || chunk == NULL) {
+        printf("Error opening file\n");
+        return 1;
+    }
+
+    // The first header sets the stream up, its packets are kept in memory
+    VideoContext stream = { 0 };
+    stream.flags = VIDEO_FLAG_HASH;
+    stream.output_format = UT_OUTPUT_NONE;
+
+    Driver d = { 0 };
+    PacketParser parser;
+    uint32_t cap = 0;
+    ssize_t n;
+    parser_init(&parser);
+    while ((n = read(fd_in, chunk, CHUNK_SIZE)) > 0) {
+        size_t pos = 0, consumed;
+        ParserUnit unit;
+
+        while (parser_parse(&parser, chunk + pos, n - pos, &consumed, &unit) > 0) {
+            pos += consumed;
+            if (unit.type == PARSER_UNIT_HEADER) {
+                if (!stream.planes)
+                    parser_decode(&stream, &unit);
+                continue;
+            }
+            if (!stream.planes)
+                continue;
+            if (d.count == cap) {
+                cap = cap ? cap * 2 : 64;
+                d.pkts = realloc(d.pkts, cap * sizeof(*d.pkts));
+                if (!d.pkts)
+                    return 1;
+            }
+
+            uint8_t * data = NULL;
+            uint32_t size = 0;
+            if (av_fast_padded_malloc(&data, &size, unit.size) < 0)
+                return 1;
+            memcpy(data, unit.data, unit.size);
+            d.pkts[d.count++] = (VideoPacket){ data, unit.size };
+        }
+    }
+    parser_free(&parser);
+    free(chunk);
+    close(fd_in);
+
+    if (!d.count) {
+        printf("No frames\n");
+        return 1;
+    }
+
+    d.hashes = calloc(d.count, sizeof(*d.hashes));
+    d.total = (uint64_t)d.count * loops;
+    pthread_mutex_init(&d.lock, NULL);
+    pthread_cond_init(&d.finished, NULL);
+    d.a = async_open(&stream, depth, frame_done, &d);
+    if (!d.hashes || !d.a) {
+        printf("Error setting up the decoder\n");
+        return 1;
+    }
+
+    // Chains of frames, one context stays free for the callbacks to submit
+    // into. With no more chains than packets a packet is done before the
+    // next loop submits it again, the hashes of the first loop are there.
+    pthread_mutex_lock(&d.lock);
+    for (int i = 0; i < depth - 1 && i < (int64_t)d.count; i++)
+        submit_next(&d);
+    while (d.done < d.total)
+        pthread_cond_wait(&d.finished, &d.lock);
+    pthread_mutex_unlock(&d.lock);
+
+    async_close(d.a);
+    printf("Frames: %" PRIu64 "\n", d.done);
+    printf("Errors: %" PRIu64 "\n", d.errors);
+
+    for (uint32_t i = 0; i < d.count; i++)
+        free((void *)d.pkts[i].data);
+    free(d.pkts);
+    free(d.hashes);
+    video_free(&stream);
+    pthread_cond_destroy(&d.finished);
+    pthread_mutex_destroy(&d.lock);
+    return d.errors != 0;
+}
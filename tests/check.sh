@@ -0,0 +1,58 @@
+#!/bin/sh
+# Runs the test drivers on generated streams.
+# Usage: tests/check.sh [directory of the built tests]
+
+bin=${1:-out/tests}
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+fail() {
+    echo "FAIL: $*"
+    exit 1
+}
+
+# The output goes to $tmp/log, shown if it fails
+run() {
+    "$@" > "$tmp/log" 2>&1 || { cat "$tmp/log"; return 1; }
+}
+
+quiet() {
+    "$@" > "$tmp/log" 2>&1
+}
+
+run "$bin/yuv" || fail "yuv"
+run "$bin/fuzz" -t "$tmp/seed" || fail "fuzz seed"
+run "$bin/fuzz" -r 2000 "$tmp/seed" || fail "fuzz mutations"
+run "$bin/vlc" 10 || fail "vlc tables"
+
+for format in ULRG ULRA ULY0 ULY2 ULY4; do
+    stream="$tmp/$format.lav"
+
+    run "$bin/gen" "$stream" $format 64 48 4 12 || fail "gen $format"
+    run "$bin/read" "$stream" "$tmp/$format.raw" || fail "read $format"
+    run "$bin/verify" "$stream" "$tmp/$format.sum" -w || fail "verify -w $format"
+    run "$bin/verify" "$stream" "$tmp/$format.sum" || fail "verify $format"
+    run "$bin/verify" "$stream" "$tmp/$format.sum" -j 3 || fail "verify $format on threads"
+    run "$bin/async" "$stream" 4 3 || fail "async $format"
+
+    # Reslicing is lossless, the frames hash the same
+    for slices in 1 7; do
+        run "$bin/reslice" "$stream" "$tmp/resliced.lav" $slices || fail "reslice $format $slices"
+        run "$bin/verify" "$tmp/resliced.lav" "$tmp/$format.sum" || fail "verify resliced $format $slices"
+        run "$bin/verify" "$tmp/resliced.lav" "$tmp/$format.sum" -j 3 || fail "verify resliced $format $slices on threads"
+    done
+done
+
+# Frame 5 of 12 doesn't decode, and only that one
+stream="$tmp/damaged.lav"
+run "$bin/gen" "$stream" ULRG 64 48 4 12 5 || fail "gen damaged"
+quiet "$bin/read" "$stream" "$tmp/damaged.raw" && fail "read damaged plainly"
+run "$bin/read" -c "$stream" "$tmp/damaged.raw" || fail "read damaged with concealment"
+quiet "$bin/verify" "$stream" "$tmp/damaged.sum" -w
+grep -q "^Errors: 1$" "$tmp/log" || fail "verify -w damaged"
+run "$bin/verify" "$stream" "$tmp/damaged.sum" || fail "verify damaged"
+run "$bin/verify" "$stream" "$tmp/damaged.sum" -j 3 || fail "verify damaged on threads"
+quiet "$bin/verify" "$stream" "$tmp/ULRG.sum"
+grep -q "^Errors: 1$" "$tmp/log" || fail "verify damaged against the intact stream"
+
+echo "All checks passed"
@@ -0,0 +1,227 @@
+// Fuzz harness for decode_frame.
+//
+// An input is a stream header (w, h, fps, frames, slices, FourCC; 18 bytes
+// as stored after HEADER_END_KEY) followed by one packet, decoded as is and
+// with slice concealment.
+//
+// With libFuzzer:
+//   clang -g -O1 -fsanitize=fuzzer,address -DUT_LIBFUZZER -I.
+//       tests/fuzz.c alloc.c decoder.c dsp.c scheduler.c video.c vlc.c
+// Without it the binary replays the given inputs, or mutates a seed input
+// at random with -r <iterations> <seed>, so it also runs under gcc/ASan.
+// -t checks that a valid input decodes, and writes it as a seed if a
+// path is given.
+
+#include "decoder.h"
+#include "video.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FUZZ_HEADER_SIZE 18
+#define FUZZ_MAX_PIXELS (1 << 20)
+
+// Frames decode_frame gave, an input that never gets there fuzzes nothing
+static long frames;
+
+static void decode_input(const uint8_t * data, size_t size, int flags) {
+    static uint8_t header[FUZZ_HEADER_SIZE];
+    VideoContext ctx = { 0 };
+    int got_frame = 0;
+
+    ctx.flags = flags;
+    memcpy(header, data, FUZZ_HEADER_SIZE);
+    if (video_from_data(&ctx, header, FUZZ_HEADER_SIZE) < 0) {
+        video_free(&ctx);
+        return;
+    }
+
+    if (video_packet_alloc(&ctx, size - FUZZ_HEADER_SIZE) == 0) {
+        memcpy(ctx.packet_data, data + FUZZ_HEADER_SIZE, ctx.packet_size);
+        if (decode_frame(&ctx, &got_frame) >= 0 && got_frame)
+            frames++;
+        // Concealing from a previous frame
+        got_frame = 0;
+        if ((flags & VIDEO_FLAG_CONCEAL) && decode_frame(&ctx, &got_frame) >= 0 && got_frame)
+            frames++;
+    }
+
+    video_free(&ctx);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t * data, size_t size) {
+    if (size < FUZZ_HEADER_SIZE)
+        return 0;
+    if (READ_U16(data) * READ_U16(data + 2) > FUZZ_MAX_PIXELS)
+        return 0;
+
+    decode_input(data, size, 0);
+    decode_input(data, size, VIDEO_FLAG_CONCEAL);
+    return 0;
+}
+
+
+#ifndef UT_LIBFUZZER
+
+static uint8_t * read_file(const char * path, size_t * size) {
+    FILE * f = fopen(path, "rb");
+    uint8_t * data;
+
+    if (f == NULL)
+        return NULL;
+
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    data = malloc(*size + 1);
+    if (data && *size && fread(data, *size, 1, f) == 0) {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    return data;
+}
+
+static uint32_t xorshift32(uint32_t * state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+// Flip, overwrite or truncate a few bytes of the packet, keep the header
+static size_t mutate(uint8_t * data, size_t size, uint32_t * rng) {
+    int n = 1 + xorshift32(rng) % 8;
+    size_t pos;
+
+    if (size <= FUZZ_HEADER_SIZE)
+        return size;
+
+    while (n--) {
+        pos = FUZZ_HEADER_SIZE + xorshift32(rng) % (size - FUZZ_HEADER_SIZE);
+        switch (xorshift32(rng) % 4) {
+            case 0: data[pos] ^= 1 << (xorshift32(rng) % 8); break;
+            case 1: data[pos] = xorshift32(rng); break;
+            case 2: data[pos] = 0xFF; break;
+            case 3: size = pos + 1; break;
+        }
+    }
+    return size;
+}
+
+#define SEED_W 16
+#define SEED_H 8
+#define SEED_SLICES 2
+
+/**
+ * A ULRG frame without prediction: the first plane is coded with 8 bit
+ * codes for every symbol (symbol s has the code 255 - s), the others are
+ * filled with a symbol.
+ */
+static size_t build_seed(uint8_t * data) {
+    uint8_t * p = data;
+
+    WRITE_U16(p, SEED_W);
+    WRITE_U16(p + 2, SEED_H);
+    WRITE_U16(p + 4, 25);
+    WRITE_U32(p + 6, 1);
+    WRITE_U32(p + 10, SEED_SLICES);
+    WRITE_U32(p + 14, MKTAG('U', 'L', 'R', 'G'));
+    p += FUZZ_HEADER_SIZE;
+
+    memset(p, 8, UT_HUFF_ELEMS);
+    p += UT_HUFF_ELEMS;
+    for (int i = 0; i < SEED_SLICES; i++)
+        WRITE_U32(p + 4 * i, (i + 1) * SEED_W * SEED_H / SEED_SLICES);
+    p += 4 * SEED_SLICES;
+    // The bits are read MSB first from little endian words
+    for (int i = 0; i < SEED_W * SEED_H; i++)
+        p[i ^ 3] = 255 - (uint8_t)(i * 7);
+    p += SEED_W * SEED_H;
+
+    for (int plane = 1; plane < UT_COLOR_PLANES; plane++) {
+        memset(p, 255, UT_HUFF_ELEMS);
+        p[0x80] = 0;
+        memset(p + UT_HUFF_ELEMS, 0, 4 * SEED_SLICES);
+        p += UT_HUFF_ELEMS + 4 * SEED_SLICES;
+    }
+    WRITE_U32(p, UT_PRED_NONE << 8);
+    p += 4;
+    return p - data;
+}
+
+static int self_test(const char * path) {
+    uint8_t data[FUZZ_HEADER_SIZE + 3 * (UT_HUFF_ELEMS + 4 * SEED_SLICES) + SEED_W * SEED_H + 4];
+    size_t size = build_seed(data);
+    FILE * f;
+
+    // Once plainly, twice with concealment
+    LLVMFuzzerTestOneInput(data, size);
+    printf("Frames: %ld\n", frames);
+    if (frames != 3) {
+        printf("The seed didn't decode\n");
+        return 1;
+    }
+
+    if (path) {
+        f = fopen(path, "wb");
+        if (f == NULL || fwrite(data, size, 1, f) != 1) {
+            printf("Error writing %s\n", path);
+            return 1;
+        }
+        fclose(f);
+    }
+    return 0;
+}
+
+int main(int argc, char ** argv) {
+    uint8_t * data, * work;
+    size_t size, work_size;
+    uint32_t rng = 0x2545F491;
+    long iterations;
+
+    if (argc < 2) {
+        printf("Usage: %s <input>... | -r <iterations> <seed> | -t [seed (out)]\n", argv[0]);
+        return 1;
+    }
+
+    if (strcmp(argv[1], "-t") == 0)
+        return self_test(argc > 2 ? argv[2] : NULL);
+
+    if (strcmp(argv[1], "-r") == 0) {
+        if (argc < 4 || (data = read_file(argv[3], &size)) == NULL) {
+            printf("Error opening seed\n");
+            return 1;
+        }
+        iterations = atol(argv[2]);
+        work = malloc(size + 1);
+        for (long i = 0; i < iterations; i++) {
+            memcpy(work, data, size);
+            work_size = mutate(work, size, &rng);
+            LLVMFuzzerTestOneInput(work, work_size);
+        }
+        printf("Iterations: %ld\n", iterations);
+        printf("Frames: %ld\n", frames);
+        free(work);
+        free(data);
+        return 0;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        if ((data = read_file(argv[i], &size)) == NULL) {
+            printf("Error opening %s\n", argv[i]);
+            return 1;
+        }
+        LLVMFuzzerTestOneInput(data, size);
+        free(data);
+    }
+    printf("Inputs: %d\n", argc - 1);
+    printf("Frames: %ld\n", frames);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,141 @@
+#include "demuxer.h"
+#include "video.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HEADER_DATA_SIZE 18
+
+
+static const struct {
+    const char * name;
+    uint32_t fourcc;
+} formats[] = {
+    { "ULRG", MKTAG('U', 'L', 'R', 'G') },
+    { "ULRA", MKTAG('U', 'L', 'R', 'A') },
+    { "ULY0", MKTAG('U', 'L', 'Y', '0') },
+    { "ULY2", MKTAG('U', 'L', 'Y', '2') },
+    { "ULY4", MKTAG('U', 'L', 'Y', '4') },
+};
+
+
+// Something that changes from pixel to pixel, plane to plane and frame
+// to frame, with every residual value showing up now and then
+static uint8_t pixel(int frame, int plane, int x, int y) {
+    return x * 3 + y * 5 + frame * 7 + plane * 50 + ((x * y) >> 3);
+}
+
+/**
+ * Code a frame as a packet payload. Even frames aren't predicted, odd ones
+ * are left predicted. Every symbol has an 8 bit code, symbol s is 255 - s,
+ * and the slices are padded to whole words.
+ * @returns the payload size
+ */
+static size_t encode_frame(const VideoContext * ctx, int frame, uint8_t * dst) {
+    const int pred = frame & 1 ? UT_PRED_LEFT : UT_PRED_NONE;
+    uint8_t * p = dst;
+    int sstart, send;
+
+    for (int i = 0; i < ctx->planes; i++) {
+        uint8_t * slice_end, * data;
+        size_t n = 0;
+
+        memset(p, 8, UT_HUFF_ELEMS);
+        slice_end = p + UT_HUFF_ELEMS;
+        data = slice_end + 4 * ctx->slices;
+        for (uint32_t slice = 0; slice < ctx->slices; slice++) {
+            int prev = 0x80;
+
+            video_slice_rows(ctx, i, ctx->plane_h[i], ctx->slices, slice, &sstart, &send);
+            for (int y = sstart; y < send; y++) {
+                for (int x = 0; x < ctx->plane_w[i]; x++) {
+                    const uint8_t v = pixel(frame, i, x, y);
+
+                    // The bits are read MSB first from little endian words
+                    data[n ^ 3] = 255 - (pred == UT_PRED_LEFT ? (uint8_t)(v - prev) : v);
+                    prev = v;
+                    n++;
+                }
+            }
+            while (n & 3)
+                data[n++ ^ 3] = 0;
+            WRITE_U32(slice_end + 4 * slice, n);
+        }
+        p = data + n;
+    }
+    WRITE_U32(p, pred << 8);
+    return p + 4 - dst;
+}
+
+// Writes a stream of generated frames, one of them damaged if asked to
+int main(int argc, char ** argv) {
+    uint8_t header[HEADER_DATA_SIZE], prefix[11];
+    VideoContext ctx = { 0 };
+    uint32_t fourcc = 0;
+    uint8_t * packet;
+    int frames, damaged;
+    FILE * out;
+
+    if (argc < 7) {
+        printf("Usage: %s <lav file (out)> <ULRG|ULRA|ULY0|ULY2|ULY4> <w> <h> <slices> <frames> [damaged frame]\n", argv[0]);
+        return 1;
+    }
+    for (size_t i = 0; i < sizeof(formats) / sizeof(*formats); i++) {
+        if (strcmp(argv[2], formats[i].name) == 0)
+            fourcc = formats[i].fourcc;
+    }
+    frames  = atoi(argv[6]);
+    damaged = argc > 7 ? atoi(argv[7]) : -1;
+
+    WRITE_U16(header, atoi(argv[3]));
+    WRITE_U16(header + 2, atoi(argv[4]));
+    WRITE_U16(header + 4, 25);
+    WRITE_U32(header + 6, frames);
+    WRITE_U32(header + 10, atoi(argv[5]));
+    WRITE_U32(header + 14, fourcc);
+    // The decoder sets up the plane geometry the frames are coded with
+    if (!fourcc || video_from_data(&ctx, header, sizeof(header)) < 0) {
+        printf("Invalid format\n");
+        return 1;
+    }
+
+    out = fopen(argv[1], "wb");
+    packet = malloc(video_packet_bound(ctx.w, ctx.h, ctx.slices, ctx.planes));
+    if (out == NULL || packet == NULL) {
+        printf("Error opening file\n");
+        return 1;
+    }
+
+    WRITE_U32(prefix, HEADER_START_KEY);
+    prefix[4] = sizeof(header);
+    WRITE_U16(prefix + 5, HEADER_END_KEY);
+    fwrite(prefix, 7, 1, out);
+    fwrite(header, sizeof(header), 1, out);
+
+    for (int frame = 0; frame < frames; frame++) {
+        const size_t size = encode_frame(&ctx, frame, packet);
+
+        // The first slice of the first plane ends past the packet
+        if (frame == damaged)
+            WRITE_U32(packet + UT_HUFF_ELEMS, UINT32_MAX);
+
+        WRITE_U32(prefix, PACKET_START_KEY);
+        prefix[4] = sizeof(uint32_t);
+        WRITE_U16(prefix + 5, PACKET_END_KEY);
+        WRITE_U32(prefix + 7, size);
+        fwrite(prefix, sizeof(prefix), 1, out);
+        fwrite(packet, size, 1, out);
+    }
+
+    if (fclose(out)) {
+        printf("Error writing file\n");
+        return 1;
+    }
+    printf("Frames: %d\n", frames);
+
+    free(packet);
+    video_free(&ctx);
+    return 0;
+}
@@ -1,138 +1,87 @@
-#include "decoder.h"
-#include "video.h"
+#define _GNU_SOURCE
+#include "demuxer.h"
+#include "sink.h"
+#include "source.h"
 
+#include <fcntl.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
-#define HEADER_START_KEY 0xF0FF00F0
-#define HEADER_END_KEY 0x7FF1
 
-#define PACKET_START_KEY 0xFFF0F0F0
-#define PACKET_END_KEY 0xF0F1
-
-
-static VideoContext ctx;
-
-int video_read_header(FILE * f) {
-    static uint8_t buf[256];
-
-    // Header size and end-key
-    if (fread(buf, sizeof(uint8_t) + sizeof(uint16_t), 1, f) == 0) {
-        // End of file or error reading
-        return 0;
-    }
-
-    if (*(uint16_t*)(buf + 1) != HEADER_END_KEY) {
-        // Not a video packet
-        return 0;
-    }
-
-    // Read the header data
-    if (fread(buf, *buf, 1, f) == 0) {
-        // End of file or error reading
-        return 0;
-    }
-
-    video_from_data(&ctx, buf);
-
-    ctx.result_frame_data = av_malloc((ctx.w + LINE_ALIGNMENT_PAD) * ctx.h * 4);
-
-    return 1;
-}
-
-
-int video_read_next_frame(FILE * file) {
-    static uint8_t buf[256];
-
-    // Find a frame
-    while (1) {
-        // Read the start key
-        if (fread(buf, sizeof(uint32_t), 1, file) == 0) {
-            // End of file or error reading
-            return 0;
-        }
-        log_info("Key: %x\n", *(uint32_t*)buf);
-        
-        if (*(uint32_t*)buf == HEADER_START_KEY) {
-            video_read_header(file);
-            continue;
-        }
-
-        if (*(uint32_t*)buf != PACKET_START_KEY) continue;
-
-        // Header size and end-key
-        if (fread(buf, sizeof(uint8_t) + sizeof(uint16_t), 1, file) == 0) {
-            // End of file or error reading
-            return 0;
-        }
-        log_info("Header size: %d\n", *buf);
-
-        if (*(uint16_t*)(buf + 1) != PACKET_END_KEY) {
-            // Not a video packet
-            continue;
-        }
-
-        // Read the header data
-        if (fread(buf, *buf, 1, file) == 0) {
-            // End of file or error reading
-            return 0;
-        }
-        ctx.packet_size = *(uint32_t*)buf;
-        log_info("Data size: %d\n", ctx.packet_size);
-
-        break;
+int main(int argc, char ** argv) {
+    int video_flags = 0, sink_flags = 0, opt;
+
+    // -c: keep damaged frames, with their bad slices repeated
+    // -d: write the output with O_DIRECT
+    while ((opt = getopt(argc, argv, "cd")) != -1) {
+        if (opt == 'c')
+            video_flags |= VIDEO_FLAG_CONCEAL;
+        else if (opt == 'd')
+            sink_flags |= SINK_FLAG_DIRECT;
+        else
+            optind = argc;
     }
-
-
-    // Read the packet
-    if (fread(ctx.packet_data, ctx.packet_size, 1, file) == 0) {
-        // End of file or error reading
-        return 0;
+    if (argc - optind < 2) {
+        printf("Usage: %s [-c] [-d] <lav file (in)> <file (out)> [raw|y4m] [every nth frame]\n", argv[0]);
+        return 1;
     }
+    char ** args = argv + optind;
+    int nargs = argc - optind;
 
-    log_info("Packet read\n");
+    int fd_in = open(args[0], O_RDONLY);
+    int fd_out = open(args[1], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int format = nargs > 2 && strcmp(args[2], "y4m") == 0 ? SINK_FORMAT_Y4M : SINK_FORMAT_RAW;
 
-    int got_frame = 0;
-    int err = 0;
-    if ((err = decode_frame(&ctx, &got_frame)) < 0) {
-        log_info("Error decoding frame: %d\n", err);
-        return 0;
-    }
-
-    if (got_frame) {
-        log_info("Frame decoded\n");
+    if (fd_in < 0 || fd_out < 0) {
+        printf("Error opening file\n");
+        return 1;
     }
 
-    return 1;
-}
-
-
-int main(int argc, char ** argv) {
-    if (argc < 3) {
-        printf("Usage: %s <lav file (in)> <file (out)>\n", argv[0]);
+    PacketSource * file_in = source_open(fd_in, 0, 0, 0);
+    if (file_in == NULL) {
+        printf("Error setting up the read-ahead\n");
         return 1;
     }
-    FILE * file_in = fopen(argv[1], "rb");
-    FILE * file_out = fopen(argv[2], "wb");
 
-    if (file_in == NULL) {
-        printf("Error opening file\n");
+    FrameSink * file_out = sink_open(fd_out, format, 0, sink_flags);
+    if (file_out == NULL) {
+        printf("Error setting up the output\n");
         return 1;
     }
 
-    int ttt = 0;
-    while (video_read_next_frame(file_in)) {
-        // Process the frame
-        //fwrite((uint8_t*)ctx.result_frame_data, (ctx.w + LINE_ALIGNMENT_PAD) * ctx.h * 4, 1, file_out);
-        //break;
+    Demuxer demuxer;
+    demuxer_init(&demuxer, file_in);
+    demuxer.video.flags = video_flags;
+    if (nargs > 3)
+        demuxer.step = atoi(args[3]);
+
+    int ttt = 0, ret;
+    uint32_t concealed = 0;
+    while ((ret = demuxer_read_frame(&demuxer)) > 0) {
+        concealed += demuxer.video.concealed_slices;
+        if (sink_write(file_out, &demuxer.video) < 0) {
+            printf("Error writing frame\n");
+            break;
+        }
         ttt++;
     }
+    if (ret < 0)
+        printf("Error decoding frame %d\n", ttt);
 
     printf("Frames: %d\n", ttt);
-
-    fclose(file_out);
-    fclose(file_in);
-    free(ctx.result_frame_data);
-    video_free(&ctx);
-    return 0;
+    printf("Concealed slices: %u\n", concealed);
+    printf("Headers: %u (%u reinitialized)\n", demuxer.headers, demuxer.reinits);
+    if (demuxer.skipped)
+        printf("Skipped packets: %u\n", demuxer.skipped);
+
+    if (sink_close(file_out) < 0)
+        printf("Error writing output\n");
+    close(fd_out);
+    demuxer_free(&demuxer);
+    source_close(file_in);
+    close(fd_in);
+    return ret < 0;
 }
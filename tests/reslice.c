@@ -0,0 +1,88 @@
+#include "parser.h"
+#include "reslice.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define CHUNK_SIZE (1 << 20)
+
+
+static int write_all(int fd, const uint8_t * data, size_t size) {
+    while (size) {
+        ssize_t n = write(fd, data, size);
+
+        if (n < 0)
+            return -1;
+        data += n;
+        size -= n;
+    }
+    return 0;
+}
+
+// Rewrites a stream to another slice count, frame for frame the same
+int main(int argc, char ** argv) {
+    if (argc < 4) {
+        printf("Usage: %s <lav file (in)> <lav file (out)> <slices>\n", argv[0]);
+        return 1;
+    }
+    int fd_in = open(argv[1], O_RDONLY);
+    int fd_out = open(argv[2], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    uint8_t * chunk = malloc(CHUNK_SIZE);
+
+    if (fd_in < 0 || fd_out < 0 || chunk == NULL) {
+        printf("Error opening file\n");
+        return 1;
+    }
+
+    Reslicer reslicer;
+    if (reslice_init(&reslicer, atoi(argv[3])) < 0) {
+        printf("Invalid slice count\n");
+        return 1;
+    }
+
+    PacketParser parser;
+    parser_init(&parser);
+
+    uint64_t size_in = 0, size_out = 0;
+    int ret = 0;
+    ssize_t n;
+    while (!ret && (n = read(fd_in, chunk, CHUNK_SIZE)) > 0) {
+        size_t pos = 0, consumed;
+        ParserUnit unit;
+
+        size_in += n;
+        while (pos < (size_t)n) {
+            const uint8_t * out;
+            uint32_t out_size;
+
+            ret = parser_parse(&parser, chunk + pos, n - pos, &consumed, &unit);
+            pos += consumed;
+            if (ret <= 0)
+                break;
+            ret = reslice_unit(&reslicer, &unit, &out, &out_size);
+            if (ret < 0)
+                break;
+            if (write_all(fd_out, out, out_size) < 0) {
+                ret = -1;
+                break;
+            }
+            size_out += out_size;
+        }
+    }
+
+    if (ret < 0)
+        printf("Error rewriting the stream\n");
+    printf("Headers: %u\n", parser.headers);
+    printf("Packets: %u\n", parser.packets);
+    printf("Size: %llu -> %llu\n", (unsigned long long)size_in, (unsigned long long)size_out);
+
+    reslice_free(&reslicer);
+    parser_free(&parser);
+    free(chunk);
+    close(fd_out);
+    close(fd_in);
+    return ret < 0;
+}
@@ -0,0 +1,114 @@
+#define _GNU_SOURCE
+#include "demuxer.h"
+#include "source.h"
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+// A frame that failed to decode has this in place of its digest, so the
+// following ones stay on their lines
+#define DIGEST_FAILED "-"
+
+
+// The next digest of the list, failed is set for DIGEST_FAILED instead.
+// Returns 0 at the end of the list or on a line that isn't a digest.
+static int read_digest(FILE * digests, uint64_t * digest, int * failed) {
+    char line[32], * end;
+
+    if (fscanf(digests, "%31s", line) != 1)
+        return 0;
+    *failed = strcmp(line, DIGEST_FAILED) == 0;
+    if (*failed)
+        return 1;
+    *digest = strtoull(line, &end, 16);
+    return *end == '\0';
+}
+
+// Checks a stream against a list of frame hashes, one hex digest per line,
+// or writes that list with -w. Frames are only hashed, never stored.
+// -j decodes the bands of each frame on that many threads.
+int main(int argc, char ** argv) {
+    int write = 0, threads = 0, opt;
+
+    while ((opt = getopt(argc, argv, "wj:")) != -1) {
+        if (opt == 'w')
+            write = 1;
+        else if (opt == 'j')
+            threads = atoi(optarg);
+        else
+            optind = argc;
+    }
+    if (argc - optind < 2) {
+        printf("Usage: %s <lav file (in)> <digests> [-w] [-j threads]\n", argv[0]);
+        return 1;
+    }
+    int fd_in = open(argv[optind], O_RDONLY);
+    FILE * digests = fopen(argv[optind + 1], write ? "w" : "r");
+
+    if (fd_in < 0 || digests == NULL) {
+        printf("Error opening file\n");
+        return 1;
+    }
+
+    PacketSource * file_in = source_open(fd_in, 0, 0, 0);
+    if (file_in == NULL) {
+        printf("Error setting up the read-ahead\n");
+        return 1;
+    }
+
+    Demuxer demuxer;
+    demuxer_init(&demuxer, file_in);
+    demuxer.video.flags = VIDEO_FLAG_HASH;
+    demuxer.video.output_format = UT_OUTPUT_NONE;
+    demuxer.video.threads = threads;
+
+    int frames = 0, errors = 0, failed, ret;
+    uint64_t expected;
+    while ((ret = demuxer_read_frame(&demuxer)) != 0) {
+        if (write) {
+            if (ret < 0) {
+                printf("Frame %d: decoding failed (%d)\n", frames, ret);
+                fprintf(digests, DIGEST_FAILED "\n");
+                errors++;
+            } else {
+                fprintf(digests, "%016" PRIx64 "\n", demuxer.video.frame_hash);
+            }
+        } else if (!read_digest(digests, &expected, &failed)) {
+            printf("Frame %d: no digest\n", frames);
+            errors++;
+        } else if (failed) {
+            // Damaged on purpose, it should stay that way
+            if (ret > 0) {
+                printf("Frame %d: decoded, a failure was expected\n", frames);
+                errors++;
+            }
+        } else if (ret < 0) {
+            printf("Frame %d: decoding failed (%d)\n", frames, ret);
+            errors++;
+        } else if (demuxer.video.frame_hash != expected) {
+            printf("Frame %d: %016" PRIx64 " instead of %016" PRIx64 "\n",
+                   frames, demuxer.video.frame_hash, expected);
+            errors++;
+        }
+        frames++;
+    }
+    if (!write && read_digest(digests, &expected, &failed)) {
+        printf("Digests left after frame %d\n", frames - 1);
+        errors++;
+    }
+
+    printf("Frames: %d\n", frames);
+    printf("Errors: %d\n", errors);
+
+    fclose(digests);
+    demuxer_free(&demuxer);
+    source_close(file_in);
+    close(fd_in);
+    return errors ? 2 : 0;
+}
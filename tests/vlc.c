@@ -0,0 +1,138 @@
+// Times building the decoding tables of a plane, build_huff() on the code
+// lengths a packet carries, for a few typical length sets. Prints the median
+// of the runs in microseconds.
+
+#define _GNU_SOURCE
+
+#include "decoder.h"
+#include "vlc.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Pixels of a 1280x720 luma plane, the counts the lengths are built from
+#define PLANE_PIXELS (1280 * 720)
+
+
+static int compare_double(const void * a, const void * b) {
+    const double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double now_us(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/**
+ * Huffman code lengths for residuals falling off as decay^|r|, residual r
+ * being symbol s read as a signed byte. Every symbol shows up at least
+ * once, which keeps the codes within 32 bits.
+ */
+static void predicted_lengths(double decay, uint8_t * lens) {
+    uint64_t count[2 * UT_HUFF_ELEMS];
+    int parent[2 * UT_HUFF_ELEMS], alive[2 * UT_HUFF_ELEMS];
+    double weight[UT_HUFF_ELEMS / 2 + 1], sum = 0;
+    int nodes = UT_HUFF_ELEMS;
+
+    weight[0] = 1;
+    for (int r = 1; r <= UT_HUFF_ELEMS / 2; r++)
+        weight[r] = weight[r - 1] * decay;
+    for (int s = 0; s < UT_HUFF_ELEMS; s++)
+        sum += weight[abs((int8_t)s)];
+    for (int s = 0; s < UT_HUFF_ELEMS; s++) {
+        count[s] = PLANE_PIXELS * weight[abs((int8_t)s)] / sum;
+        count[s] += !count[s];
+        alive[s] = 1;
+    }
+
+    // Merge the two rarest nodes until one is left
+    while (nodes < 2 * UT_HUFF_ELEMS - 1) {
+        int a = -1, b = -1;
+
+        for (int i = 0; i < nodes; i++) {
+            if (!alive[i])
+                continue;
+            if (a < 0 || count[i] < count[a]) {
+                b = a;
+                a = i;
+            } else if (b < 0 || count[i] < count[b]) {
+                b = i;
+            }
+        }
+        count[nodes] = count[a] + count[b];
+        parent[a] = parent[b] = nodes;
+        alive[a] = alive[b] = 0;
+        alive[nodes++] = 1;
+    }
+
+    for (int s = 0; s < UT_HUFF_ELEMS; s++) {
+        int len = 0;
+
+        for (int i = s; i < nodes - 1; i = parent[i])
+            len++;
+        lens[s] = len;
+    }
+}
+
+int main(int argc, char ** argv) {
+    static const struct {
+        const char * name;
+        double decay;       // 0 for flat 8 bit codes
+    } sets[] = {
+        { "flat 8-bit codes (noise)", 0 },
+        { "predicted, decay 0.6", 0.6 },
+        { "predicted, decay 0.85", 0.85 },
+        { "predicted, decay 0.95", 0.95 },
+    };
+    const int runs = argc > 1 ? atoi(argv[1]) : 2000;
+    VideoContext ctx = { 0 };
+    double * times;
+
+    if (runs <= 0) {
+        printf("Usage: %s [runs]\n", argv[0]);
+        return 1;
+    }
+    times = malloc(runs * sizeof(*times));
+    if (times == NULL)
+        return 1;
+
+    for (size_t i = 0; i < sizeof(sets) / sizeof(*sets); i++) {
+        uint8_t lens[UT_HUFF_ELEMS];
+        int max_len = 0;
+
+        if (sets[i].decay > 0)
+            predicted_lengths(sets[i].decay, lens);
+        else
+            for (int s = 0; s < UT_HUFF_ELEMS; s++)
+                lens[s] = 8;
+        for (int s = 0; s < UT_HUFF_ELEMS; s++)
+            max_len = lens[s] > max_len ? lens[s] : max_len;
+
+        for (int run = 0; run < runs; run++) {
+            VLC vlc = { 0 };
+            VLC_MULTI multi = { 0 };
+            double start;
+            int fsym;
+
+            start = now_us();
+            if (build_huff(&ctx, lens, &vlc, &multi, &fsym) < 0) {
+                printf("%s: invalid code lengths\n", sets[i].name);
+                return 1;
+            }
+            times[run] = now_us() - start;
+            vlc_free(&vlc);
+            vlc_free_multi(&multi);
+        }
+
+        qsort(times, runs, sizeof(*times), compare_double);
+        printf("%-26s codes up to %2d bits: %7.2f us\n", sets[i].name, max_len, times[runs / 2]);
+    }
+
+    free(times);
+    return 0;
+}
@@ -0,0 +1,58 @@
+#include "defs.h"
+#include "dsp.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Odd, so the last column takes the single column path
+#define WIDTH 33
+
+
+// Converts every grey level, black to white, with both matrices. Grey has
+// no chroma, U and V have to be 128 whatever the level.
+int main(void) {
+    static const char * names[] = { "BT.601", "BT.709" };
+    // A row per level, the R-G and B-G planes are 0x80 for grey
+    uint8_t g[256][WIDTH], rb[256][WIDTH];
+    uint8_t y[256][WIDTH], u[128][WIDTH], v[128][WIDTH], nv12[128][WIDTH + 1];
+    int errors = 0;
+
+    for (int level = 0; level < 256; level++) {
+        memset(g[level], level, WIDTH);
+        memset(rb[level], 0x80, WIDTH);
+    }
+
+    for (int matrix = UT_MATRIX_BT601; matrix <= UT_MATRIX_BT709; matrix++) {
+        rgb_planes_to_yuv420(
+            rb[0], g[0], rb[0], WIDTH, WIDTH, 256, matrix,
+            y[0], WIDTH, u[0], v[0], WIDTH
+        );
+        rgb_planes_to_yuv420(
+            rb[0], g[0], rb[0], WIDTH, WIDTH, 256, matrix,
+            y[0], WIDTH, nv12[0], NULL, WIDTH + 1
+        );
+
+        // Rows 2k and 2k + 1 share their chroma
+        for (int row = 0; row < 128; row++) {
+            for (int i = 0; i < (WIDTH + 1) / 2; i++) {
+                if (u[row][i] != 128 || v[row][i] != 128 ||
+                    nv12[row][2 * i] != 128 || nv12[row][2 * i + 1] != 128) {
+                    printf("%s, levels %d and %d: U %d V %d, NV12 U %d V %d\n",
+                           names[matrix], 2 * row, 2 * row + 1, u[row][i], v[row][i],
+                           nv12[row][2 * i], nv12[row][2 * i + 1]);
+                    errors++;
+                    break;
+                }
+            }
+        }
+        // Limited range luma
+        if (y[0][0] != 16 || y[255][0] != 235) {
+            printf("%s: Y %d for black and %d for white\n", names[matrix], y[0][0], y[255][0]);
+            errors++;
+        }
+    }
+
+    printf("Errors: %d\n", errors);
+    return errors != 0;
+}
@@ -45,6 +45,8 @@ typedef union U64 {
 #define CONSUME_U64(p) CONSUME_ULE(64, p)
 
 
+#define MKTAG(a, b, c, d) ((a) | ((b) << 8) | ((c) << 16) | ((unsigned)(d) << 24))
+
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 
@@ -58,6 +60,8 @@ typedef union U64 {
 #define EINVAL 22
 #define ENOSYS 38
 #define ENOMEM 12
+#define EBUSY 16
+#define EAGAIN 11
 #define AVERROR(e) (-(e))
 #define AVERROR_INVALIDDATA AVERROR(EINVAL)
 #define AVERROR_PATCHWELCOME AVERROR(ENOSYS)
@@ -81,23 +85,6 @@ static av_pure_expr uint64_t av_bswap64(uint64_t x) {
 }
 
 
-static void bswap_buf(uint32_t *dst, const uint32_t *src, int w) {
-    int i;
-    for (i = 0; i + 8 <= w; i += 8) {
-        dst[i + 0] = av_bswap32(src[i + 0]);
-        dst[i + 1] = av_bswap32(src[i + 1]);
-        dst[i + 2] = av_bswap32(src[i + 2]);
-        dst[i + 3] = av_bswap32(src[i + 3]);
-        dst[i + 4] = av_bswap32(src[i + 4]);
-        dst[i + 5] = av_bswap32(src[i + 5]);
-        dst[i + 6] = av_bswap32(src[i + 6]);
-        dst[i + 7] = av_bswap32(src[i + 7]);
-    }
-    for (; i < w; i++)
-        dst[i + 0] = av_bswap32(src[i + 0]);
-}
-
-
 static const uint8_t ff_reverse[256] = {
 0x00,0x80,0x40,0xC0,0x20,0xA0,0x60,0xE0,0x10,0x90,0x50,0xD0,0x30,0xB0,0x70,0xF0,
 0x08,0x88,0x48,0xC8,0x28,0xA8,0x68,0xE8,0x18,0x98,0x58,0xD8,0x38,0xB8,0x78,0xF8,
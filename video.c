@@ -0,0 +1,263 @@
+#include "video.h"
+#include "defs.h"
+#include "mem.h"
+#include "utils.h"
+#include <stdint.h>
+#include <string.h>
+
+
+#define FRAME_BUF_ALIGN(x) (((x) + MEM_ALIGN_SIZE - 1) & ~(size_t)(MEM_ALIGN_SIZE - 1))
+// Where the slice count and the FourCC are in the header data
+#define HEADER_SLICES_OFFSET 10
+#define HEADER_FOURCC_OFFSET 14
+
+static void video_free_planes(VideoContext * ctx) {
+    video_buf_free(ctx->allocator, ctx->frame_buf, ctx->frame_buf_size);
+    ctx->frame_buf = NULL;
+    ctx->frame_buf_size = 0;
+    for (int i = 0; i < UT_MAX_PLANES; i++) {
+        ctx->frame_data[i] = NULL;
+        ctx->prev_frame_data[i] = NULL;
+    }
+    for (int i = 0; i < UT_COLOR_PLANES; i++) {
+        ctx->preview_data[i] = NULL;
+        ctx->yuv_data[i] = NULL;
+    }
+    ctx->preview_rgba = NULL;
+    ctx->tensor_data = NULL;
+    ctx->tensor_size = 0;
+    ctx->hash_row = NULL;
+    ctx->prev_valid = 0;
+    ctx->result_frame_data = NULL;
+    ctx->vlc_buf = NULL;
+    ctx->vlc_buf_size = 0;
+    ctx->planes = 0;
+}
+
+int video_init(VideoContext * ctx) {
+    int hshift = 0, vshift = 0;
+    const int pshift = ctx->preview_shift, pround = (1 << pshift) - 1;
+    size_t offset[UT_MAX_PLANES], prev_offset[UT_MAX_PLANES];
+    size_t preview_offset[UT_COLOR_PLANES], yuv_offset[UT_COLOR_PLANES];
+    size_t result_offset = 0, vlc_offset, size = 0;
+    const int rgb = video_is_rgb(ctx);
+    const int planes = ctx->format == UT_FMT_RGBA ? UT_MAX_PLANES : UT_COLOR_PLANES;
+    const int yuv_out = rgb &&
+        (ctx->output_format == UT_OUTPUT_YUV420 || ctx->output_format == UT_OUTPUT_NV12);
+    const int tensor_out = rgb &&
+        (ctx->output_format == UT_OUTPUT_FLOAT || ctx->output_format == UT_OUTPUT_HALF);
+    const int hash = ctx->flags & VIDEO_FLAG_HASH;
+    size_t tensor_size = 0;
+
+    // Whatever a previous header set up goes, the packet and slice
+    // buffers don't depend on the geometry and are kept
+    video_free_planes(ctx);
+
+    switch (ctx->format) {
+        case UT_FMT_YUV420:
+            vshift = 1;
+            // fallthrough
+        case UT_FMT_YUV422:
+            hshift = 1;
+            break;
+    }
+    if (!ctx->w || !ctx->h || !ctx->slices || ctx->slices > UT_MAX_SLICES) {
+        log_info("Invalid dimensions or slice count\n");
+        return AVERROR_INVALIDDATA;
+    }
+    if ((ctx->w & hshift) || (ctx->h & vshift)) {
+        log_info("Odd dimensions for a subsampled format\n");
+        return AVERROR_INVALIDDATA;
+    }
+    if (pshift > VIDEO_PREVIEW_MAX_SHIFT || ctx->output_format > UT_OUTPUT_NONE ||
+        ctx->output_matrix > UT_MATRIX_BT709 || (pshift && (yuv_out || tensor_out)) ||
+        (hash && (pshift || yuv_out || tensor_out)))
+        return AVERROR(EINVAL);
+
+    for (int i = 0; i < planes; i++) {
+        ctx->plane_w[i] = i ? ctx->w >> hshift : ctx->w;
+        ctx->plane_h[i] = i ? ctx->h >> vshift : ctx->h;
+        // The linesize can be larger than frame width
+        ctx->linesize[i] = ctx->plane_w[i] + LINE_ALIGNMENT_PAD;
+        offset[i] = size;
+        size += FRAME_BUF_ALIGN((size_t)ctx->linesize[i] * ctx->plane_h[i]);
+    }
+    if (ctx->flags & VIDEO_FLAG_CONCEAL) {
+        for (int i = 0; i < planes; i++) {
+            prev_offset[i] = size;
+            size += FRAME_BUF_ALIGN((size_t)ctx->linesize[i] * ctx->plane_h[i]);
+        }
+    }
+    if (pshift) {
+        // A partial group of rows or columns at the end still gives a pixel
+        for (int i = 0; i < UT_COLOR_PLANES; i++) {
+            ctx->preview_w[i] = (ctx->plane_w[i] + pround) >> pshift;
+            ctx->preview_h[i] = (ctx->plane_h[i] + pround) >> pshift;
+            preview_offset[i] = size;
+            if (!rgb)
+                size += FRAME_BUF_ALIGN((size_t)ctx->preview_w[i] * ctx->preview_h[i]);
+        }
+        if (rgb)
+            size += FRAME_BUF_ALIGN((size_t)ctx->preview_w[0] * ctx->preview_h[0] * 4);
+    } else if (yuv_out) {
+        // The chroma of an odd last row or column is still there
+        ctx->yuv_linesize[0] = ctx->w;
+        ctx->yuv_linesize[1] = (ctx->w + 1) >> 1;
+        if (ctx->output_format == UT_OUTPUT_NV12)
+            ctx->yuv_linesize[1] *= 2;
+        ctx->yuv_linesize[2] = ctx->output_format == UT_OUTPUT_NV12 ? 0 : ctx->yuv_linesize[1];
+        for (int i = 0; i < UT_COLOR_PLANES; i++) {
+            yuv_offset[i] = size;
+            size += FRAME_BUF_ALIGN((size_t)ctx->yuv_linesize[i] * (i ? (ctx->h + 1) >> 1 : ctx->h));
+        }
+    } else if (tensor_out) {
+        tensor_size = (size_t)ctx->w * ctx->h * UT_COLOR_PLANES
+            * (ctx->output_format == UT_OUTPUT_FLOAT ? sizeof(float) : sizeof(uint16_t));
+        result_offset = size;
+        size += FRAME_BUF_ALIGN(tensor_size);
+    } else if (rgb && ctx->output_format == UT_OUTPUT_NONE) {
+        result_offset = size;
+        if (hash)
+            size += FRAME_BUF_ALIGN((size_t)ctx->w * 4);
+    } else if (rgb) {
+        result_offset = size;
+        size += FRAME_BUF_ALIGN((size_t)(ctx->w + LINE_ALIGNMENT_PAD) * ctx->h * 4);
+    }
+    vlc_offset = size;
+    size += FRAME_BUF_ALIGN(ctx->w + 8);
+
+    // One allocation for all of them. Only the row buffer is cleared here,
+    // the plane pages are first touched by whoever decodes into them.
+    ctx->frame_buf = video_buf_alloc(ctx->allocator, size);
+    if (!ctx->frame_buf)
+        return AVERROR(ENOMEM);
+    ctx->frame_buf_size = size;
+
+    for (int i = 0; i < planes; i++)
+        ctx->frame_data[i] = ctx->frame_buf + offset[i];
+    if (ctx->flags & VIDEO_FLAG_CONCEAL) {
+        for (int i = 0; i < planes; i++)
+            ctx->prev_frame_data[i] = ctx->frame_buf + prev_offset[i];
+    }
+    if (pshift && rgb) {
+        ctx->preview_rgba = (uint32_t *)(ctx->frame_buf + preview_offset[0]);
+    } else if (pshift) {
+        for (int i = 0; i < UT_COLOR_PLANES; i++)
+            ctx->preview_data[i] = ctx->frame_buf + preview_offset[i];
+    } else if (yuv_out) {
+        for (int i = 0; i < UT_COLOR_PLANES; i++)
+            ctx->yuv_data[i] = ctx->yuv_linesize[i] ? ctx->frame_buf + yuv_offset[i] : NULL;
+    } else if (tensor_out) {
+        ctx->tensor_data = ctx->frame_buf + result_offset;
+        ctx->tensor_size = tensor_size;
+        // Nothing set is plain 0 to 1
+        if (!ctx->output_scale[0] && !ctx->output_scale[1] && !ctx->output_scale[2]) {
+            for (int i = 0; i < UT_COLOR_PLANES; i++)
+                ctx->output_scale[i] = 1.0f / 255;
+        }
+    } else if (rgb && ctx->output_format == UT_OUTPUT_NONE) {
+        if (hash)
+            ctx->hash_row = (uint32_t *)(ctx->frame_buf + result_offset);
+    } else if (rgb) {
+        ctx->result_frame_data = (uint32_t *)(ctx->frame_buf + result_offset);
+    }
+    ctx->vlc_buf = ctx->frame_buf + vlc_offset;
+    ctx->vlc_buf_size = ctx->w + 8;
+    memset(ctx->vlc_buf, 0, ctx->vlc_buf_size);
+
+    ctx->planes = planes;
+    return 0;
+}
+
+int video_packet_alloc(VideoContext * ctx, uint32_t size) {
+    int ret;
+
+    if (ctx->planes && !video_packet_size_valid(ctx, size)) {
+        ctx->packet_size = 0;
+        return AVERROR_INVALIDDATA;
+    }
+    ret = av_fast_padded_malloc(&ctx->packet_data, &ctx->packet_buf_size, size);
+    ctx->packet_size = ret ? 0 : size;
+    return ret;
+}
+
+size_t video_memory_usage(const VideoContext * ctx) {
+    return ctx->packet_buf_size + ctx->slice_buf_size + ctx->job_buf_size + ctx->frame_buf_size;
+}
+
+int video_from_data(VideoContext * c, uint8_t * data, uint32_t size) {
+    uint32_t fourcc = MKTAG('U', 'L', 'R', 'G');
+    uint16_t w, h, fps;
+    uint32_t slices;
+    uint8_t format;
+
+    if (size < HEADER_SLICES_OFFSET + 4)
+        return AVERROR_INVALIDDATA;
+
+    w = CONSUME_U16(data);
+    h = CONSUME_U16(data);
+
+    fps = CONSUME_U16(data);
+    // frames
+    data += 4;
+
+    slices = CONSUME_U32(data);
+
+    // Older headers end here and carry RGB only
+    if (size >= HEADER_FOURCC_OFFSET + 4)
+        fourcc = CONSUME_U32(data);
+
+    switch (fourcc) {
+        case MKTAG('U', 'L', 'R', 'G'):
+            format = UT_FMT_RGB;
+            break;
+        case MKTAG('U', 'L', 'R', 'A'):
+            format = UT_FMT_RGBA;
+            break;
+        case MKTAG('U', 'L', 'Y', '0'):
+            format = UT_FMT_YUV420;
+            break;
+        case MKTAG('U', 'L', 'Y', '2'):
+            format = UT_FMT_YUV422;
+            break;
+        case MKTAG('U', 'L', 'Y', '4'):
+            format = UT_FMT_YUV444;
+            break;
+        default:
+            log_info("Unsupported FourCC %x\n", fourcc);
+            return AVERROR_PATCHWELCOME;
+    }
+
+    c->fps = fps;
+
+    // Captures repeat the header every so often, the buffers only depend
+    // on the frame size and format, so the same header costs nothing
+    if (c->planes && c->w == w && c->h == h && c->format == format) {
+        if (!slices || slices > UT_MAX_SLICES)
+            return AVERROR_INVALIDDATA;
+        c->slices = slices;
+        return 0;
+    }
+
+    c->w = w;
+    c->h = h;
+    c->slices = slices;
+    c->format = format;
+    return video_init(c);
+}
+
+void video_free(VideoContext * ctx) {
+    video_free_planes(ctx);
+    free(ctx->packet_data);
+    free(ctx->slice_buf);
+    free(ctx->job_buf);
+    scheduler_stream_close(ctx->stream);
+    ctx->packet_data = NULL;
+    ctx->packet_buf_size = 0;
+    ctx->packet_size = 0;
+    ctx->slice_buf = NULL;
+    ctx->slice_buf_size = 0;
+    ctx->job_buf = NULL;
+    ctx->job_buf_size = 0;
+    ctx->stream = NULL;
+}
@@ -1,77 +1,210 @@
 #ifndef __UT_VIDEO_H__
 #define __UT_VIDEO_H__
 
+#include "alloc.h"
 #include "defs.h"
-#include "mem.h"
+#include "scheduler.h"
 #include "utils.h"
+#include <stddef.h>
 #include <stdint.h>
-#include <string.h>
 
 #ifndef LINE_ALIGNMENT_PAD
     #define LINE_ALIGNMENT_PAD 0
 #endif
 
+// Decode the valid slices of a damaged frame and take the rows of the
+// others from the previous frame, instead of failing the whole frame
+#define VIDEO_FLAG_CONCEAL 1
+
+// Compute frame_hash over the output, RGBA rows for RGB and the planes
+// for YUV, without a preview or another output format
+#define VIDEO_FLAG_HASH 2
+
+// Previews are 1/2, 1/4 or 1/8 of the frame size
+#define VIDEO_PREVIEW_MAX_SHIFT 3
+
+
+struct VideoContext;
+
+/**
+ * Rows y to y + h - 1 of the output are final, called top to bottom
+ * while the rest of the frame is still decoding, or once all of it is
+ * with threads. With a preview they are
+ * rows of the full frame, the preview rows from y rounded up to
+ * y + h rounded up, divided by 1 << preview_shift, are final. With YUV
+ * output from RGB the bands are whole chroma rows, rows of a band that
+ * don't pair up are reported with the next one.
+ */
+typedef void (video_band_fn)(void * opaque, const struct VideoContext * ctx, int y, int h);
+
 
 typedef struct VideoContext {
     uint16_t w;
     uint16_t h;
+    // Frames per second, as in the header, only passed on to the output
+    uint16_t fps;
     uint32_t slices;
-    
-    int linesize;
-    uint8_t * frame_data[UT_COLOR_PLANES];
-
+    uint8_t format;
+    uint8_t planes;
+    uint8_t frame_pred;
+
+    // Per plane geometry, the chroma planes are subsampled for YUV formats.
+    // For YUV formats the planes are the decoded output.
+    uint16_t plane_w[UT_MAX_PLANES];
+    uint16_t plane_h[UT_MAX_PLANES];
+    int linesize[UT_MAX_PLANES];
+    uint8_t * frame_data[UT_MAX_PLANES];
+
+    // Packed RGBA output, allocated for RGB formats without a preview
+    // or another output format. Alpha comes from the alpha plane of ULRA
+    // streams, it is opaque otherwise and in the other outputs.
     uint32_t * result_frame_data;
 
+    // Reduced output when preview_shift is 1 to VIDEO_PREVIEW_MAX_SHIFT, set
+    // before the first header. Every (1 << preview_shift)th row is kept, with
+    // the columns averaged in groups of as many, into packed RGBA rows for
+    // RGB, or planes for YUV. Rows are preview_w pixels apart.
+    uint8_t preview_shift;
+    uint16_t preview_w[UT_COLOR_PLANES];
+    uint16_t preview_h[UT_COLOR_PLANES];
+    uint8_t * preview_data[UT_COLOR_PLANES];
+    uint32_t * preview_rgba;
+
+    // What RGB streams are restored to, UT_OUTPUT_* with a UT_MATRIX_* for
+    // YUV, set before the first header. YUV goes to yuv_data instead of
+    // result_frame_data, for NV12 yuv_data[1] has U and V interleaved.
+    uint8_t output_format;
+    uint8_t output_matrix;
+    uint8_t * yuv_data[UT_COLOR_PLANES];
+    int yuv_linesize[UT_COLOR_PLANES];
+
+    // For UT_OUTPUT_FLOAT and UT_OUTPUT_HALF, the R, G and B planes of
+    // w * h values, each value * output_scale + output_offset of its
+    // channel. The scales default to 1 / 255 when none is set, they can
+    // change between frames.
+    float output_scale[UT_COLOR_PLANES];
+    float output_offset[UT_COLOR_PLANES];
+    void * tensor_data;
+    size_t tensor_size;
+
+    // With VIDEO_FLAG_HASH, the hash of the last frame. With UT_OUTPUT_NONE
+    // the RGBA rows are restored one at a time into hash_row only.
+    uint64_t frame_hash;
+    uint64_t hash_state[UT_COLOR_PLANES];
+    uint32_t * hash_row;
+
+    // VIDEO_FLAG_*, set before the first header
+    int flags;
+
+    // With VIDEO_FLAG_CONCEAL, a bit per slice of the last frame that was
+    // concealed, and how many. frame_data then alternates between two sets
+    // of planes, the other one holding the previous frame.
+    uint64_t slice_errors[UT_MAX_SLICES / 64];
+    uint32_t concealed_slices;
+    uint8_t * prev_frame_data[UT_MAX_PLANES];
+    int prev_valid;
+
+    // Optional, called as each band of slices is restored
+    video_band_fn * band_callback;
+    void * band_opaque;
+
+    // Scratch buffers grow on demand, the sizes are the allocated ones
     uint8_t * packet_data;
     uint32_t packet_size;
+    uint32_t packet_buf_size;
 
     uint8_t * slice_buf;
     uint32_t slice_buf_size;
-    
+
     uint8_t * vlc_buf;
     uint32_t vlc_buf_size;
-} VideoContext;
-
 
-int video_init(VideoContext * ctx) {
-    for (int i = 0; i < UT_COLOR_PLANES; i++) {
-        // The linesize can be larger than frame width
-        ctx->frame_data[i] = av_malloc((ctx->w + LINE_ALIGNMENT_PAD) * ctx->h);
-    }
-    ctx->linesize = ctx->w + LINE_ALIGNMENT_PAD;
-
-    ctx->packet_data = av_malloc(ctx->w * ctx->h * 4);
+    // The planes, the RGBA output and vlc_buf point in there, and the
+    // previous planes when concealing
+    uint8_t * frame_buf;
+    size_t frame_buf_size;
+    // How frame_buf is allocated, av_malloc if NULL. Set it before the
+    // first header and leave it while the buffers are allocated.
+    const VideoAllocator * allocator;
+
+    // Jobs decoding the slices of a frame at once on the shared scheduler,
+    // those of every plane of a band alongside each other, the calling
+    // thread running one. Decoded serially if 0 or 1.
+    int threads;
+    // Opened on the first frame with threads, closed by video_free
+    SchedulerStream * stream;
+    // The slice and row buffers of the jobs
+    uint8_t * job_buf;
+    uint32_t job_buf_size;
+} VideoContext;
 
-    ctx->slice_buf_size = ctx->w * ctx->h * 4 + ctx->w * 4;
-    ctx->slice_buf = av_malloc(ctx->slice_buf_size);
 
-    ctx->vlc_buf_size = ctx->w + 8;
-    ctx->vlc_buf = av_malloc(ctx->vlc_buf_size);
-    memset(ctx->vlc_buf, 0, ctx->vlc_buf_size);
+static av_pure_expr int video_is_rgb(const VideoContext * ctx) {
+    return ctx->format == UT_FMT_RGB || ctx->format == UT_FMT_RGBA;
+}
 
-    return 0;
+static av_always_inline int video_slice_concealed(const VideoContext * ctx, int slice) {
+    return ctx->slice_errors[slice >> 6] >> (slice & 63) & 1;
 }
 
-int video_from_data(VideoContext * c, uint8_t * data) {
-    c->w = CONSUME_U16(data);
-    c->h = CONSUME_U16(data);
-    
-    // fps, frames
-    data += 6;
+/**
+ * Rows sstart to send - 1 of a plane of the given height make up the
+ * given slice, when the frame is cut into slices.
+ */
+static av_always_inline void video_slice_rows(
+    const VideoContext * ctx, int plane_no, int height, uint32_t slices, int slice,
+    int * sstart, int * send
+) {
+    // 4:2:0 luma slices start on even rows, so they match the chroma ones
+    const int cmask = !plane_no && ctx->format == UT_FMT_YUV420 ? ~1 : ~0;
+
+    *sstart = (height * slice / slices) & cmask;
+    *send   = (height * (slice + 1) / slices) & cmask;
+}
 
-    c->slices = CONSUME_U32(data);
-    
-    return video_init(c);
+/**
+ * The largest packet a frame can take, with full size planes coded at
+ * 32 bits a pixel, the longest code. The container's packet sizes are
+ * checked against it before anything is allocated.
+ */
+static av_always_inline uint64_t video_packet_bound(
+    uint32_t w, uint32_t h, uint32_t slices, int planes
+) {
+    // Code lengths and slice offsets per plane, then the frame info
+    return (UT_HUFF_ELEMS + 4 * (uint64_t)slices + 4 * (uint64_t)w * h) * planes + 4;
 }
 
-void video_free(VideoContext * ctx) {
-    for (int i = 0; i < UT_COLOR_PLANES; i++) {
-        free(ctx->frame_data[i]);
-    }
-    free(ctx->packet_data);
-    free(ctx->slice_buf);
-    free(ctx->vlc_buf);
+static av_always_inline int video_packet_size_valid(const VideoContext * ctx, uint32_t size) {
+    return size <= video_packet_bound(ctx->w, ctx->h, ctx->slices, ctx->planes);
 }
 
+/**
+ * Set up the plane geometry and buffers for the parsed w/h/slices/format,
+ * replacing the ones of an earlier header. The context starts zeroed.
+ * On failure planes is 0 and the context can't decode.
+ */
+int video_init(VideoContext * ctx);
+
+/**
+ * Get packet_data ready to receive a packet of the given size.
+ * @returns 0, AVERROR_INVALIDDATA if the size is beyond
+ *          video_packet_bound() of a set up context, or AVERROR(ENOMEM)
+ */
+int video_packet_alloc(VideoContext * ctx, uint32_t size);
+
+/**
+ * Bytes currently held by the context buffers, the RGBA output included.
+ * Per plane VLC tables are short-lived and not counted.
+ */
+size_t video_memory_usage(const VideoContext * ctx);
+
+/**
+ * Parse a stream header and initialize the context from it. A header
+ * with the frame size and format already set up keeps the buffers.
+ */
+int video_from_data(VideoContext * c, uint8_t * data, uint32_t size);
+
+void video_free(VideoContext * ctx);
+
 
 #endif // __UT_VIDEO_H__
@@ -0,0 +1,296 @@
+#include "vlc.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <memory.h>
+
+#include "defs.h"
+#include "utils.h"
+#include "mem.h"
+
+
+#define LOCALBUF_ELEMS 1500 // the maximum currently needed is 1296 by rv34
+
+#define VLC_GET_DATA(v, table, i, wrap, size)               \
+{                                                           \
+    const uint8_t *ptr = (const uint8_t *)table + i * wrap; \
+    switch(size) {                                          \
+    case 1:                                                 \
+        v = *(const uint8_t *)ptr;                          \
+        break;                                              \
+    case 2:                                                 \
+        v = *(const uint16_t *)ptr;                         \
+        break;                                              \
+    case 4:                                                 \
+    default:                                                \
+        v = *(const uint32_t *)ptr;                         \
+        break;                                              \
+    }                                                       \
+}
+
+
+static int alloc_table(VLC *vlc, int size) {
+    int index = vlc->table_size;
+
+    vlc->table_size += size;
+    if (vlc->table_size > vlc->table_allocated) {
+        vlc->table_allocated += (1 << UT_VLC_BITS);
+        vlc->table = av_realloc_f(vlc->table, vlc->table_allocated, sizeof(*vlc->table));
+        if (!vlc->table) {
+            return AVERROR(ENOMEM);
+        }
+        memset(vlc->table + vlc->table_allocated - (1 << UT_VLC_BITS), 0, sizeof(*vlc->table) << UT_VLC_BITS);
+    }
+    return index;
+}
+
+/**
+ * Build VLC decoding tables suitable for use with get_vlc().
+ *
+ * @param vlc            the context to be initialized
+ *
+ * @param table_nb_bits  max length of vlc codes to store directly in this table
+ *                       (Longer codes are delegated to subtables.)
+ *
+ * @param nb_codes       number of elements in codes[]
+ *
+ * @param codes          descriptions of the vlc codes
+ *                       These must be ordered such that codes going into the same subtable are contiguous.
+ *                       Sorting by VLCcode.code is sufficient, though not necessary.
+ */
+static int build_table(
+    VLC *vlc, int table_nb_bits, int nb_codes, VLCcode *codes
+) {
+    int table_size, table_index;
+    VLCElem *table;
+
+    if (table_nb_bits > 30)
+       return AVERROR(EINVAL);
+
+    table_size = 1 << table_nb_bits;
+    table_index = alloc_table(vlc, table_size);
+    log_info("new table index=%d size=%d\n", table_index, table_size);
+    if (table_index < 0)
+        return table_index;
+    table = &vlc->table[table_index];
+
+    /* first pass: map codes and compute auxiliary table sizes */
+    for (int i = 0; i < nb_codes; i++) {
+        int         n = codes[i].bits;
+        uint32_t code = codes[i].code;
+        int    symbol = codes[i].symbol;
+        log_info("i=%d n=%d code=0x%x\n", i, n, code);
+        if (n <= table_nb_bits) {
+            /* no need to add another table */
+            int   j = code >> (32 - table_nb_bits);
+            int  nb = 1 << (table_nb_bits - n);
+            const VLCElem e = { .sym = symbol, .len = n };
+
+            log_info("%4x: code=%d n=%d\n", j, i, n);
+            // The codes come from lengths and were checked to be prefix
+            // free, so the range is known to be empty
+            for (int k = 0; k < nb; k++)
+                table[j + k] = e;
+        } else {
+            /* fill auxiliary table recursively */
+            uint32_t code_prefix;
+            int index, subtable_bits, j, k;
+
+            n -= table_nb_bits;
+            code_prefix = code >> (32 - table_nb_bits);
+            subtable_bits = n;
+            codes[i].bits = n;
+            codes[i].code = code << table_nb_bits;
+
+            for (k = i + 1; k < nb_codes; k++) {
+                n = codes[k].bits - table_nb_bits;
+                code = codes[k].code;
+                if (n <= 0 || code >> (32 - table_nb_bits) != code_prefix)
+                    break;
+                codes[k].bits = n;
+                codes[k].code = code << table_nb_bits;
+                subtable_bits = MAX(subtable_bits, n);
+            }
+
+            subtable_bits = MIN(subtable_bits, table_nb_bits);
+            j = code_prefix;
+            table[j].len = -subtable_bits;
+            log_info("%4x: n=%d (subtable)\n", j, codes[i].bits + table_nb_bits);
+
+            index = build_table(vlc, subtable_bits, k-i, codes+i);
+            if (index < 0)
+                return index;
+            /* note: realloc has been done, so reload tables */
+            table = &vlc->table[table_index];
+            table[j].sym = index;
+
+            if (table[j].sym != index) {
+                log_info("strange codes\n");
+                return AVERROR_PATCHWELCOME;
+            }
+            i = k-1;
+        }
+    }
+
+    for (int i = 0; i < table_size; i++) {
+        if (table[i].len == 0)
+            table[i].sym = -1;
+    }
+
+    return table_index;
+}
+
+/**
+ * Fill the multi symbol table from the single one.
+ *
+ * An entry holds the longest run of codes the index starts with: after
+ * a code the remaining bits are looked up in the single table again,
+ * zero filled, and a code found there is part of the index when it ends
+ * within the index bits. Runs are kept below limit bits and to
+ * VLC_MULTI_MAX_SYMBOLS codes, anything shorter than two codes is the
+ * single table entry.
+ *
+ * The indices are walked in order. When a run can't grow, not even by the
+ * shortest code, all the indices starting with it share the entry, which
+ * is then stored over the whole range at once. Entries are put together
+ * in a register, byte stores to the struct would stall the copy after.
+ */
+static void vlc_multi_gen(
+    VLC_MULTI_ELEM *table, const VLCElem *single, int minbits, int limit
+) {
+    const unsigned mask = (1 << UT_VLC_BITS) - 1;
+    unsigned idx = 0, nb;
+
+    while (idx <= mask) {
+        const VLCElem first = single[idx];
+        const VLCElem *next;
+        int len = first.len, num = 1;
+        uint64_t e = (uint8_t)first.sym;
+
+        if (len > 0 && len < limit) {
+            for (; num < VLC_MULTI_MAX_SYMBOLS; num++) {
+                next = &single[(idx << len) & mask];
+                if (next->len <= 0 || len + next->len >= limit)
+                    break;
+                e   |= (uint64_t)(uint8_t)next->sym << (num * 8);
+                len += next->len;
+            }
+        }
+
+        if (num == 1) {
+            e   = (uint16_t)first.sym;
+            len = first.len;
+            num = len > 0;
+        }
+
+        nb = 1;
+        if (len > 0 && (num == VLC_MULTI_MAX_SYMBOLS || len + minbits >= limit))
+            nb = 1U << (UT_VLC_BITS - len);
+
+        e |= (uint64_t)(uint8_t)len << (offsetof(VLC_MULTI_ELEM, len) * 8);
+        e |= (uint64_t)num << (offsetof(VLC_MULTI_ELEM, num) * 8);
+        for (unsigned k = 0; k < nb; k++)
+            WRITE_U64(&table[idx + k], e);
+        idx += nb;
+    }
+}
+
+static int vlc_common_end(
+    VLC *vlc,
+    int nb_bits,
+    int nb_codes,
+    VLCcode *codes,
+    VLCcode localbuf[LOCALBUF_ELEMS]
+) {
+    int ret = build_table(vlc, nb_bits, nb_codes, codes);
+
+    if (codes != localbuf)
+        free(codes);
+    if (ret < 0) {
+        free(vlc->table);
+        vlc->table = NULL;
+        return ret;
+    }
+    return 0;
+}
+
+static int vlc_init_common(VLC *vlc, int nb_codes,
+                           VLCcode **buf)
+{
+    vlc->table_size = 0;
+    vlc->table           = NULL;
+    vlc->table_allocated = 0;
+    if (nb_codes > LOCALBUF_ELEMS) {
+        *buf = av_malloc(nb_codes * sizeof(VLCcode));
+        if (!*buf)
+            return AVERROR(ENOMEM);
+    }
+
+    return 0;
+}
+
+int vlc_init_multi_from_lengths(
+    VLC *vlc, VLC_MULTI *multi,
+    int nb_codes,
+    const uint8_t *lens, int lens_wrap,
+    const void *symbols, int symbols_wrap
+) {
+    VLCcode localbuf[LOCALBUF_ELEMS], *buf = localbuf;
+    uint64_t code;
+    int ret, j, len_max = MIN(32, 3 * UT_VLC_BITS), minbits = 32, maxbits = 0;
+
+    ret = vlc_init_common(vlc, nb_codes, &buf);
+    if (ret < 0)
+        return ret;
+
+    multi->table = av_malloc(sizeof(VLC_MULTI_ELEM) << UT_VLC_BITS);
+    if (!multi->table)
+        return AVERROR(ENOMEM);
+
+    j = code = 0;
+    for (int i = 0; i < nb_codes; i++, lens += lens_wrap) {
+        int len = *lens;
+        if (len > 0) {
+            unsigned sym;
+
+            buf[j].bits = len;
+            if (symbols)
+                VLC_GET_DATA(sym, symbols, i, symbols_wrap, UT_VLC_SYMBOLS_SIZE)
+            else
+                sym = i;
+            buf[j].symbol = sym;
+            buf[j++].code = code;
+        } else if (len <  0) {
+            len = -len;
+        } else
+            continue;
+        if (len > len_max || code & ((1U << (32 - len)) - 1)) {
+            log_info("Invalid VLC (length %d)\n", len);
+            goto fail;
+        }
+        code += 1U << (32 - len);
+        if (code > UINT32_MAX + 1ULL) {
+            log_info("Overdetermined VLC tree\n");
+            goto fail;
+        }
+    }
+    // Runs of codes stay shorter than the longest code in the first table
+    for (int i = 0; i < j; i++) {
+        minbits = MIN(minbits, buf[i].bits);
+        if (buf[i].bits <= UT_VLC_BITS)
+            maxbits = MAX(maxbits, buf[i].bits);
+    }
+
+    ret = vlc_common_end(vlc, UT_VLC_BITS, j, buf, buf);
+    if (ret < 0)
+        goto fail;
+    vlc_multi_gen(multi->table, vlc->table, minbits, maxbits);
+    if (buf != localbuf)
+        free(buf);
+    return 0;
+fail:
+    if (buf != localbuf)
+        free(buf);
+    vlc_free_multi(multi);
+    return AVERROR_INVALIDDATA;
+}